@@ -1,10 +1,42 @@
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <new>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define STACK_X86_KERNELS
+#include <immintrin.h>
+#endif
 
 #include "stack.h"
 #include "../libs/log_generator.h"
 
+#if defined(STACK_HUGE_PAGES_ENABLED) && defined(__linux__)
+#define STACK_MAPPED_BLOCKS
+#include <limits.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+#ifdef STACK_SPILL_ENABLED
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#if defined(STACK_COMPRESSION_ENABLED) || defined(STACK_SPILL_ENABLED)
+#define STACK_PACKED_SEGMENTS
+#endif
+
+#if defined(STACK_SCRUBBER_ENABLED) || defined(STACK_REGISTRY_ENABLED)
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <system_error>
+#include <thread>
+#endif
+
 #ifdef STACK_POISON
     #define PUT_POISON(begin, end) putPoison(begin, end)
 
@@ -26,30 +58,29 @@ void putPoison(elem_t* begin, elem_t* end)
 }
 
 //-----------------------------------------------------------------------------
-//! Checks whether or not stack's dynamicArray has POISON in unused space and 
-//! sets stack's errorStatus to MEMORY_CORRUPTION if there's an unused element
-//! that doesn't have POISON.
+//! Checks whether or not array has POISON exactly in unused space [size, 
+//! capacity).
 //!
-//! @param [in]  stack    
+//! @param [in]  array    
+//! @param [in]  size    
+//! @param [in]  capacity    
 //!
-//! @return whether or not stack's dynamicArray has POISON in unused space.
+//! @return whether or not array has POISON exactly in unused space.
 //-----------------------------------------------------------------------------
-bool stackCheckPoison(Stack* stack)
+bool arrayCheckPoison(const elem_t* array, size_t size, size_t capacity)
 {
-    for (size_t i = 0; i < stack->size; i++)
+    for (size_t i = 0; i < size; i++)
     {
-        if (IS_STACK_POISON(stack->dynamicArray[i]))
+        if (IS_STACK_POISON(array[i]))
         {
-            stack->errorStatus = STACK_MEMORY_CORRUPTION;
             return false;
         }
     }
 
-    for (size_t i = stack->size; i < stack->capacity; i++)
+    for (size_t i = size; i < capacity; i++)
     {
-        if (!IS_STACK_POISON(stack->dynamicArray[i]))
+        if (!IS_STACK_POISON(array[i]))
         {
-            stack->errorStatus = STACK_MEMORY_CORRUPTION;
             return false;
         }
     }
@@ -57,6 +88,18 @@ bool stackCheckPoison(Stack* stack)
     return true;
 }
 
+//-----------------------------------------------------------------------------
+//! Checks whether or not stack's dynamicArray has POISON in unused space.
+//!
+//! @param [in]  stack    
+//!
+//! @return whether or not stack's dynamicArray has POISON in unused space.
+//-----------------------------------------------------------------------------
+bool stackCheckPoison(const Stack* stack)
+{
+    return arrayCheckPoison(stack->dynamicArray, stack->size, stack->capacity);
+}
+
 #else
     #define PUT_POISON(begin, end) 
 #endif
@@ -151,26 +194,31 @@ void setCanaries(void* memBlock, size_t memBlockSize, uint32_t canaryL, uint32_t
 }
 
 //-----------------------------------------------------------------------------
-//! Checks whether or not stack's canaries have correct values and sets stack's
-//! errorStatus to MEMORY_CORRUPTION if they don't.
+//! Checks whether or not canaries around array have correct values.
+//!
+//! @param [in]  array    
+//! @param [in]  capacity    
+//!
+//! @return whether or not array's canaries have correct values.
+//-----------------------------------------------------------------------------
+bool arrayCheckCanaries(elem_t* array, size_t capacity)
+{
+    return getCanary((void*)array, capacity * sizeof(elem_t), 'l') == STACK_ARRAY_CANARY_L && 
+           getCanary((void*)array, capacity * sizeof(elem_t), 'r') == STACK_ARRAY_CANARY_R;
+}
+
+//-----------------------------------------------------------------------------
+//! Checks whether or not stack's canaries have correct values.
 //!
 //! @param [in]  stack    
 //!
 //! @return whether or not stack's canaries have correct values.
 //-----------------------------------------------------------------------------
-bool stackCheckCanaries(Stack* stack)
+bool stackCheckCanaries(const Stack* stack)
 {
-
-    if (getCanary((void*)stack->dynamicArray, stack->capacity * sizeof(elem_t), 'l') != STACK_ARRAY_CANARY_L  || 
-        getCanary((void*)stack->dynamicArray, stack->capacity * sizeof(elem_t), 'r') != STACK_ARRAY_CANARY_R  ||
-        stack->canaryL                                                               != STACK_STRUCT_CANARY_L ||
-        stack->canaryR                                                               != STACK_STRUCT_CANARY_R)
-    {
-        stack->errorStatus = STACK_MEMORY_CORRUPTION;
-        return false;
-    }
-
-    return true;
+    return arrayCheckCanaries(stack->dynamicArray, stack->capacity) &&
+           stack->canaryL == STACK_STRUCT_CANARY_L                  &&
+           stack->canaryR == STACK_STRUCT_CANARY_R;
 }
 
 #else
@@ -179,699 +227,6057 @@ bool stackCheckCanaries(Stack* stack)
     #define SET_CANARIES(memBlock, memBlockSize, canaryL, canaryR) 
 #endif
 
-#ifdef STACK_ARRAY_HASHING
-    #define STACK_UPDATE_HASH(stack) stackUpdateHash(stack)
-
+#if defined(STACK_ARRAY_HASHING) || defined(STACK_SPILL_ENABLED)
 //-----------------------------------------------------------------------------
-//! Updates hash value. Computes XOR for rotated right hash and current byte 
+//! Computes hash value. Computes XOR for rotated right hash and current byte 
 //! (does this for each byte of memBlock).
 //!
 //! @param [in]  memBlock  
 //! @param [in]  memBlockSize   
-//! @param [out] hash   
+//! @param [in]  baseHashValue   
+//!
+//! @return hash of memBlock.
 //-----------------------------------------------------------------------------
-void updateHash(void* memBlock, size_t memBlockSize, uint32_t* hash, uint32_t baseHashValue)
+uint32_t computeHash(const void* memBlock, size_t memBlockSize, uint32_t baseHashValue)
 {
-    *hash = baseHashValue;
-    for (char* currByte = (char*) memBlock; currByte < (char*)memBlock + memBlockSize; currByte++)
+    uint32_t hash = baseHashValue;
+    for (const char* currByte = (const char*) memBlock; currByte < (const char*)memBlock + memBlockSize; currByte++)
     {
-        *hash = ((*hash << 1) + ((*hash >> (8 * sizeof(*hash) - 1)) & 1)) ^ *currByte;
+        hash = ((hash << 1) + ((hash >> (8 * sizeof(hash) - 1)) & 1)) ^ *currByte;
     }
+
+    return hash;
 }
+#endif
 
-void stackUpdateHash(Stack* stack)
+#ifdef STACK_ARRAY_HASHING
+    #define STACK_UPDATE_HASH(stack)                 stackUpdateHash(stack)
+    #define ARRAY_UPDATE_HASH(array, size, capacity) arrayUpdateHash(array, size, capacity)
+
+//-----------------------------------------------------------------------------
+//! Updates hash value. See computeHash().
+//!
+//! @param [in]  memBlock  
+//! @param [in]  memBlockSize   
+//! @param [out] hash   
+//-----------------------------------------------------------------------------
+void updateHash(void* memBlock, size_t memBlockSize, uint32_t* hash, uint32_t baseHashValue)
 {
-    updateHash((void*)stack->dynamicArray, 
-               stack->capacity * sizeof(elem_t), 
-               (uint32_t*) &stack->dynamicArray[stack->capacity], 
-               2 * (stack->size << 1) + 3 * (stack->capacity >> 1));
+    *hash = computeHash(memBlock, memBlockSize, baseHashValue);
 }
 
 //-----------------------------------------------------------------------------
-//! Checks whether or not stack's hash has correct value.
-//!
-//! @param [in]  stack    
+//! @param [in]  size  
+//! @param [in]  capacity   
 //!
-//! @return whether or not stack's hash has correct value.
+//! @return base hash value of a dynamic array with given size and capacity.
 //-----------------------------------------------------------------------------
-bool stackCheckHash(Stack* stack)
+uint32_t stackHashBase(size_t size, size_t capacity)
 {
-    uint32_t prevHash = *(uint32_t*) &stack->dynamicArray[stack->capacity];
-    STACK_UPDATE_HASH(stack);
-    uint32_t newHash  = *(uint32_t*) &stack->dynamicArray[stack->capacity];
-
-    if (prevHash != newHash)
-    {
-        stack->errorStatus = STACK_MEMORY_CORRUPTION;
-        return false;
-    }
-
-    return true;
+    return 2 * (size << 1) + 3 * (capacity >> 1);
 }
 
-#else
-    #define STACK_UPDATE_HASH(stack) 
-#endif
+//-----------------------------------------------------------------------------
+//! Updates hash stored after array. 
+//!
+//! @param [out]  array  
+//! @param [in]   size  
+//! @param [in]   capacity  
+//-----------------------------------------------------------------------------
+void arrayUpdateHash(elem_t* array, size_t size, size_t capacity)
+{
+    updateHash((void*)array, capacity * sizeof(elem_t), (uint32_t*) &array[capacity], stackHashBase(size, capacity));
+}
 
 //-----------------------------------------------------------------------------
-//! Stack's constructor. Allocates max(capacity, MINIMAL_STACK_CAPACITY) 
-//! objects of type elem_t.
+//! Updates hash stored after stack's dynamicArray. Scrubbed stacks' hash is 
+//! kept by the scrubber instead, so this does nothing for them.
 //!
 //! @param [out]  stack  
-//! @param [in]   capacity   
-//!
-//! @note if calloc returned NULL then sets stack's errorStatus to 
-//!       INITIALIZATION_FAILED.
-//!
-//! @return stack if constructed successfully or NULL otherwise.
 //-----------------------------------------------------------------------------
-#ifdef STACK_DEBUG_MODE
-Stack* fstackConstruct(Stack* stack, size_t capacity, const char* stackName)
-#else
-Stack* fstackConstruct(Stack* stack, size_t capacity)
-#endif
+void stackUpdateHash(Stack* stack)
 {
-    assert(stack != NULL);
-    assert(capacity > 0);
-
-    #ifdef STACK_DEBUG_MODE
-    stack->name = stackName;
-    #endif
-
-    stack->size         = 0;
-    stack->capacity     = capacity > MINIMAL_STACK_CAPACITY ? capacity : MINIMAL_STACK_CAPACITY;
-
-    stack->dynamicArray = (elem_t*) ((char*)calloc(1, stack->capacity * sizeof(elem_t) 
-
-                                                   #ifdef STACK_CANARIES_ENABLED
-                                                   + sizeof(STACK_ARRAY_CANARY_L) 
-                                                   + sizeof(STACK_ARRAY_CANARY_R) 
-                                                   #endif
-                                               
-                                                   #ifdef STACK_ARRAY_HASHING
-                                                   + sizeof(uint32_t)
-                                                   #endif
-                                                   )
-                                     #ifdef STACK_CANARIES_ENABLED
-                                     + sizeof(STACK_ARRAY_CANARY_L)
-                                     #endif 
-                                    );
-
-    if (stack->dynamicArray == NULL) 
+    #ifdef STACK_SCRUBBER_ENABLED
+    if (stack->scrubbed)
     {
-        stack->errorStatus = STACK_CONSTRUCTION_FAILED;
-        ASSERT_STACK_OK(stack);
-        return NULL;
+        return;
     }
+    #endif
 
-    SET_CANARIES((void*)stack->dynamicArray, stack->capacity * sizeof(elem_t), STACK_ARRAY_CANARY_L, STACK_ARRAY_CANARY_R);
-    
-    PUT_POISON(stack->dynamicArray, stack->dynamicArray + stack->capacity);
-    STACK_UPDATE_HASH(stack);
-
-    stack->status = STACK_STATUS_CONSTRUCTED;
-    ASSERT_STACK_OK(stack);
-
-    return stack;
+    arrayUpdateHash(stack->dynamicArray, stack->size, stack->capacity);
 }
 
 //-----------------------------------------------------------------------------
-//! Stack's constructor. Allocates DEFAULT_STACK_CAPACITY objects of type 
-//! elem_t.
+//! Checks whether or not hash stored after array has correct value.
 //!
-//! @param [out]  stack   
-//!
-//! @note if calloc returned NULL then sets stack's errorStatus to 
-//!       INITIALIZATION_FAILED.
+//! @param [in]  array    
+//! @param [in]  size    
+//! @param [in]  capacity    
 //!
-//! @return stack if constructed successfully or NULL otherwise.
+//! @return whether or not array's hash has correct value.
 //-----------------------------------------------------------------------------
-#ifdef STACK_DEBUG_MODE
-Stack* fstackConstruct(Stack* stack, const char* stackName)
-#else
-Stack* fstackConstruct(Stack* stack)
-#endif
+bool arrayCheckHash(const elem_t* array, size_t size, size_t capacity)
 {
-    #ifdef STACK_DEBUG_MODE
-    stack = fstackConstruct(stack, DEFAULT_STACK_CAPACITY, stackName);
-    #else
-    stack = fstackConstruct(stack, DEFAULT_STACK_CAPACITY);
-    #endif
-
-    ASSERT_STACK_OK(stack);
-
-    return stack;
+    return *(const uint32_t*) &array[capacity] == computeHash(array, 
+                                                               capacity * sizeof(elem_t), 
+                                                               stackHashBase(size, capacity));
 }
 
 //-----------------------------------------------------------------------------
-//! Allocates a Stack, calls constructor and returns the pointer to this Stack.
+//! Checks whether or not stack's hash has correct value. Scrubbed stacks' 
+//! hash is checked by the scrubber.
 //!
-//! @param [in]  capacity   
-//!
-//! @note if calloc returned NULL then sets stack's errorStatus to 
-//!       INITIALIZATION_FAILED.
-//! @note if capacity is less than MINIMAL_STACK_CAPACITY, than sets capacity
-//!       to MINIMAL_STACK_CAPACITY.
+//! @param [in]  stack    
 //!
-//! @return stack if constructed successfully or NULL otherwise.
+//! @return whether or not stack's hash has correct value.
 //-----------------------------------------------------------------------------
-Stack* newStack(size_t capacity)
+bool stackCheckHash(const Stack* stack)
 {
-    assert(capacity > 0);
-
-    Stack* newStack = (Stack*) calloc(1, sizeof(Stack));
-
-    #ifdef STACK_DEBUG_MODE
-    fstackConstruct(newStack, DYNAMICALLY_CREATED_STACK_NAME);
-    #else
-    fstackConstruct(newStack);
+    #ifdef STACK_SCRUBBER_ENABLED
+    if (stack->scrubbed)
+    {
+        return true;
+    }
     #endif
 
-    return newStack;
+    return arrayCheckHash(stack->dynamicArray, stack->size, stack->capacity);
 }
 
+#else
+    #define STACK_UPDATE_HASH(stack)                 
+    #define ARRAY_UPDATE_HASH(array, size, capacity) 
+#endif
+
+#if defined(STACK_SCRUBBER_ENABLED) || defined(STACK_DEBUG_MODE)
+    #define STACK_WRITE_BEGIN(stack) stackWriteBegin(stack)
+    #define STACK_WRITE_END(stack)   stackWriteEnd(stack)
+
 //-----------------------------------------------------------------------------
-//! Allocates a Stack, calls constructor and returns the pointer to this Stack.
+//! Opens write section of the stack. While the section is open the stack's 
+//! seqlock sequence is odd, so the scrubber skips it.
 //!
-//! @note if calloc returned NULL then sets stack's errorStatus to 
-//!       INITIALIZATION_FAILED.
-//! @note starting capacity is DEFAULT_STACK_CAPACITY
-//!
-//! @return stack if constructed successfully or NULL otherwise.
+//! @param [out]  stack  
 //-----------------------------------------------------------------------------
-Stack* newStack()
+void stackWriteBegin(Stack* stack)
 {
-    return newStack(DEFAULT_STACK_CAPACITY);
+    #ifdef STACK_SCRUBBER_ENABLED
+    stack->sequence.store(stack->sequence.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    #endif
 }
 
 //-----------------------------------------------------------------------------
-//! Stack's destructor. Calls free for stack's dynamicArray.
+//! Closes write section of the stack. In debug mode this invalidates all 
+//! stack's views.
 //!
-//! @param [out]  stack   
+//! @param [out]  stack  
 //-----------------------------------------------------------------------------
-void stackDestruct(Stack* stack)
+void stackWriteEnd(Stack* stack)
 {
-    ASSERT_STACK_OK(stack);
-    PUT_POISON(stack->dynamicArray, stack->dynamicArray + stack->capacity);
+    #ifdef STACK_DEBUG_MODE
+    stack->modificationCount++;
+    #endif
 
-    #ifdef STACK_CANARIES_ENABLED
-    free((char*)stack->dynamicArray - sizeof(STACK_ARRAY_CANARY_L));
-    #else
-    free(stack->dynamicArray);
+    #ifdef STACK_SCRUBBER_ENABLED
+    stack->sequence.store(stack->sequence.load(std::memory_order_relaxed) + 1, std::memory_order_release);
     #endif
+}
 
-    stack->size         = 0;
-    stack->capacity     = 0;
-    stack->dynamicArray = NULL;
+#else
+    #define STACK_WRITE_BEGIN(stack) 
+    #define STACK_WRITE_END(stack)   
+#endif
 
-    stack->status = STACK_STATUS_DESTRUCTED;
-}
+#ifdef STACK_SCRUBBER_ENABLED
+    #define STACK_SCRUBBER_QUIESCE(first, second) std::unique_lock<std::mutex> scrubberLock = stackScrubberQuiesce(first, second)
+
+void                         stackScrubberRetire (void* memBlock);
+std::unique_lock<std::mutex> stackScrubberQuiesce(const Stack* first, const Stack* second);
+bool                         stackScrubberRemove (Stack* stack);
+
+#else
+    #define STACK_SCRUBBER_QUIESCE(first, second) 
+#endif
+
+#ifdef STACK_REGISTRY_ENABLED
+    #define STACK_REGISTRY_ENROLL(stack) stackRegistryEnroll(stack)
+    #define STACK_REGISTRY_REMOVE(stack) stackRegistryRemove(stack)
+    #define STACK_REGISTRY_QUIESCE()     std::unique_lock<std::mutex> registryLock = stackRegistryQuiesce()
+
+void                         stackRegistryEnroll (Stack* stack);
+void                         stackRegistryRemove (Stack* stack);
+std::unique_lock<std::mutex> stackRegistryQuiesce();
+
+#else
+    #define STACK_REGISTRY_ENROLL(stack) 
+    #define STACK_REGISTRY_REMOVE(stack) 
+    #define STACK_REGISTRY_QUIESCE()     
+#endif
+
+#if defined(STACK_SCRUBBER_ENABLED) || defined(STACK_REGISTRY_ENABLED)
+// Fields of stacks read by the scrubber or the registry while their owner may
+// be writing them
+#if defined(__GNUC__)
+    #define STACK_RELAXED_LOAD(value) __atomic_load_n(&(value), __ATOMIC_RELAXED)
+#else
+    #define STACK_RELAXED_LOAD(value) (*(const volatile decltype(value)*) &(value))
+#endif
+#endif
 
 //-----------------------------------------------------------------------------
-//! Calls destructor of stack and free of stack. Undefined behavior if stack
-//! wasn't created dynamically using newStack() or an allocator.
+//! @param [in]  capacity  
 //!
-//! @param [out]  stack   
+//! @return size in bytes of the memory block holding a dynamic array of 
+//!         capacity elements together with its canaries and hash.
 //-----------------------------------------------------------------------------
-void deleteStack(Stack* stack)
+size_t arrayBlockSize(size_t capacity)
 {
-    ASSERT_STACK_OK(stack);
+    return capacity * sizeof(elem_t) 
 
-    stackDestruct(stack);
+           #ifdef STACK_CANARIES_ENABLED
+           + sizeof(STACK_ARRAY_CANARY_L) 
+           + sizeof(STACK_ARRAY_CANARY_R)
+           #endif
 
-    free(stack);
+           #ifdef STACK_ARRAY_HASHING
+           + sizeof(uint32_t)
+           #endif
+           ;
 }
 
 //-----------------------------------------------------------------------------
-//! @param [in]  stack   
+//! @param [in]  dynamicArray  
 //!
-//! @return current size of stack.
+//! @return pointer to the beginning of the memory block holding dynamicArray.
 //-----------------------------------------------------------------------------
-size_t stackSize(Stack* stack)
+void* arrayBlockBegin(elem_t* dynamicArray)
 {
-    ASSERT_STACK_OK(stack);
+    return (char*) dynamicArray
 
-    return stack->size;
+           #ifdef STACK_CANARIES_ENABLED
+           - sizeof(STACK_ARRAY_CANARY_L)
+           #endif
+           ;
 }
 
 //-----------------------------------------------------------------------------
-//! @param [in]  stack   
+//! @param [in]  memBlock  
 //!
-//! @return current capacity of stack.
+//! @return dynamic array stored in memBlock or NULL if memBlock is NULL.
 //-----------------------------------------------------------------------------
-size_t stackCapacity(Stack* stack)
+elem_t* arrayFromBlock(void* memBlock)
 {
-    ASSERT_STACK_OK(stack);
+    if (memBlock == NULL)
+    {
+        return NULL;
+    }
 
-    return stack->capacity;
+    return (elem_t*) ((char*) memBlock
+
+                      #ifdef STACK_CANARIES_ENABLED
+                      + sizeof(STACK_ARRAY_CANARY_L)
+                      #endif
+                     );
 }
 
+#ifdef STACK_MAPPED_BLOCKS
+// Values of MPOL_BIND and MPOL_INTERLEAVE from <linux/mempolicy.h>, which 
+// isn't always installed.
+static const int    STACK_MPOL_BIND       = 2;
+static const int    STACK_MPOL_INTERLEAVE = 3;
+static const size_t STACK_HUGE_PAGE_SIZE  = 2 << 20;
+
+// Precedes every memory block, so that blocks can be freed and resized 
+// correctly whatever stack (or frozen segment) owns them by then.
+struct StackBlockHeader
+{
+    size_t mappedSize; // 0 if the block was allocated with calloc/realloc
+    size_t blockSize;
+};
+
 //-----------------------------------------------------------------------------
-//! @param [in]  stack   
+//! @param [in]  policy  
+//! @param [in]  size    
 //!
-//! @return current stack's errorStatus.
+//! @return whether or not a memory block of size bytes should be mapped 
+//!         according to policy.
 //-----------------------------------------------------------------------------
-StackErrors stackErrorStatus (Stack* stack)
+bool stackShouldMapBlock(const StackMemoryPolicy* policy, size_t size)
 {
-    assert(stack != NULL);
-
-    return stack->errorStatus;
+    return (policy->pages != STACK_PAGES_DEFAULT || policy->numa != STACK_NUMA_DEFAULT) && 
+           size >= policy->threshold;
 }
 
 //-----------------------------------------------------------------------------
-//! Resizes stack's array to newCapacity. If reallocation was unsuccessful, 
-//! returns NULL, sets stack's errorStatus to REALLOCATION_FAILED, but current
-//! elements of the stack won't be removed.
-//!
-//! @param [out]  stack   
-//! @param [in]   newCapacity   
+//! Maps memory for a block of size bytes with header according to policy. 
+//! Huge pages and NUMA placement are best-effort, the mapping succeeds 
+//! without them.
 //!
-//! @note if newCapacity is less than stack's size then there will be DATA 
-//!       LOSS!
+//! @param [in]  policy  
+//! @param [in]  size    
 //!
-//! @return pointer to the new stack's array if reallocation was successful 
-//!         or NULL otherwise.
+//! @return header of the mapped block or NULL if mmap failed.
 //-----------------------------------------------------------------------------
-elem_t* resizeArray(Stack* stack, size_t newCapacity)
+StackBlockHeader* mapBlock(const StackMemoryPolicy* policy, size_t size)
 {
-    elem_t* newDynamicArray = NULL;
-    ASSERT_STACK_OK(stack);
-
-    newDynamicArray = (elem_t*) ((char*) realloc((char*) stack->dynamicArray 
-                                                 
-                                                 #ifdef STACK_CANARIES_ENABLED
-                                                 - sizeof(STACK_ARRAY_CANARY_L)
-                                                 #endif
-                                                 , 
-                                                 newCapacity * sizeof(elem_t) 
-
-                                                 #ifdef STACK_CANARIES_ENABLED
-                                                 + sizeof(STACK_ARRAY_CANARY_L) 
-                                                 + sizeof(STACK_ARRAY_CANARY_R)
-                                                 #endif
-
-                                                 #ifdef STACK_ARRAY_HASHING
-                                                 + sizeof(uint32_t)
-                                                 #endif
-                                                ) 
-
-                                 #ifdef STACK_CANARIES_ENABLED
-                                 + sizeof(STACK_ARRAY_CANARY_L)
-                                 #endif  
-                                 );
+    size_t pageSize   = (size_t) sysconf(_SC_PAGESIZE);
+    size_t mappedSize = (sizeof(StackBlockHeader) + size + pageSize - 1) / pageSize * pageSize;
+    void*  mapping    = MAP_FAILED;
 
-    if (newDynamicArray == NULL)
+    #ifdef MAP_HUGETLB
+    if (policy->pages == STACK_PAGES_EXPLICIT_HUGE)
     {
-        stack->errorStatus = STACK_REALLOCATION_FAILED;
-        ASSERT_STACK_OK(stack);
+        // Only explicit huge page mappings have to be whole huge pages
+        size_t hugeMappedSize = (sizeof(StackBlockHeader) + size + STACK_HUGE_PAGE_SIZE - 1) / 
+                                STACK_HUGE_PAGE_SIZE * STACK_HUGE_PAGE_SIZE;
+
+        mapping = mmap(NULL, hugeMappedSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+
+        if (mapping != MAP_FAILED)
+        {
+            mappedSize = hugeMappedSize;
+        }
     }
-    else
+    #endif
+
+    if (mapping == MAP_FAILED)
     {
-        stack->dynamicArray = newDynamicArray;
-        stack->capacity     = newCapacity;
+        mapping = mmap(NULL, mappedSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
 
-        PUT_POISON(stack->dynamicArray + stack->size, stack->dynamicArray + stack->capacity);
-        SET_CANARY((void*)stack->dynamicArray, stack->capacity * sizeof(elem_t), STACK_ARRAY_CANARY_R, 'r');
-        STACK_UPDATE_HASH(stack);
+        if (mapping == MAP_FAILED)
+        {
+            return NULL;
+        }
+
+        // Best-effort: fails if the kernel has no transparent huge pages, and
+        // only the mapping's whole aligned huge pages can be backed by them
+        #ifdef MADV_HUGEPAGE
+        if (policy->pages != STACK_PAGES_DEFAULT)
+        {
+            madvise(mapping, mappedSize, MADV_HUGEPAGE);
+        }
+        #endif
     }
 
-    return newDynamicArray;
+    // Must be done before the header is written, as the policy only affects
+    // pages faulted in after it is set. Best-effort too: fails without NUMA 
+    // support or for nodes that don't exist, leaving the default placement.
+    #ifdef SYS_mbind
+    if (policy->numa != STACK_NUMA_DEFAULT && policy->numaNodes != 0)
+    {
+        syscall(SYS_mbind, mapping, mappedSize, 
+                policy->numa == STACK_NUMA_BIND ? STACK_MPOL_BIND : STACK_MPOL_INTERLEAVE,
+                &policy->numaNodes, sizeof(policy->numaNodes) * CHAR_BIT + 1, 0);
+    }
+    #endif
+
+    StackBlockHeader* header = (StackBlockHeader*) mapping;
+    header->mappedSize = mappedSize;
+
+    return header;
 }
+#endif
 
 //-----------------------------------------------------------------------------
-//! Push value to stack.
+//! Allocates zeroed memory block of size bytes for stack's dynamic array, 
+//! according to stack's memory policy if there is one.
 //!
-//! @param [out]  stack   
-//! @param [in]   value   
-//!
-//! @note if realloc returned NULL then sets stack's errorStatus to 
-//!       REALLOCATION_FAILED.
+//! @param [in]  stack  
+//! @param [in]  size  
 //!
-//! @return NO_ERROR if pushed successfully or some STACK_ERRORS code 
-//!         otherwise.
+//! @return allocated memory block or NULL if allocation failed.
 //-----------------------------------------------------------------------------
-StackErrors stackPush(Stack* stack, elem_t value)
+void* allocateBlock(Stack* stack, size_t size)
 {
-    ASSERT_STACK_OK(stack);
+    #ifdef STACK_MAPPED_BLOCKS
+    StackBlockHeader* header = NULL;
 
-    if (stack->size == stack->capacity)
+    if (stackShouldMapBlock(&stack->memoryPolicy, size))
     {
-        elem_t* newDynamicArray = resizeArray(stack, stack->capacity * STACK_EXPAND_MULTIPLIER);
+        header = mapBlock(&stack->memoryPolicy, size);
+    }
 
-        if (newDynamicArray == NULL)
+    if (header == NULL)
+    {
+        header = (StackBlockHeader*) calloc(1, sizeof(StackBlockHeader) + size);
+
+        if (header == NULL)
         {
-            return STACK_REALLOCATION_FAILED;
+            return NULL;
         }
     }
 
-    stack->dynamicArray[stack->size] = value;
-    stack->size++;
-
-    STACK_UPDATE_HASH(stack);
-    ASSERT_STACK_OK(stack);
+    header->blockSize = size;
 
-    return STACK_NO_ERROR;
+    return header + 1;
+    #else
+    return calloc(1, size);
+    #endif
 }
 
 //-----------------------------------------------------------------------------
-//! Removes the element on top of the stack and returns it. Undefined behavior
-//! if the stack is empty!
+//! Frees memory block allocated by allocateBlock() or reallocateBlock().
 //!
-//! @param [out]  stack    
+//! @param [in]  memBlock  
+//-----------------------------------------------------------------------------
+void freeBlock(void* memBlock)
+{
+    #ifdef STACK_MAPPED_BLOCKS
+    if (memBlock == NULL)
+    {
+        return;
+    }
+
+    StackBlockHeader* header = (StackBlockHeader*) memBlock - 1;
+
+    if (header->mappedSize > 0)
+    {
+        munmap(header, header->mappedSize);
+    }
+    else
+    {
+        free(header);
+    }
+    #else
+    free(memBlock);
+    #endif
+}
+
+//-----------------------------------------------------------------------------
+//! Resizes memory block to size bytes like realloc, moving it between mapped
+//! and heap memory if stack's memory policy says so.
 //!
-//! @note if pop is called from an empty stack then sets the stack's 
-//!       errorStatus to POP_FROM_EMPTY.
+//! @param [in]  stack  
+//! @param [in]  memBlock  
+//! @param [in]  size  
 //!
-//! @return the element on top of the stack.
+//! @return resized memory block or NULL if reallocation failed, in which case
+//!         memBlock is left intact.
 //-----------------------------------------------------------------------------
-elem_t stackPop(Stack* stack)
+void* reallocateBlock(Stack* stack, void* memBlock, size_t size)
 {
-    ASSERT_STACK_OK(stack);
- 
-    if (stack->size == 0)
+    #ifdef STACK_MAPPED_BLOCKS
+    StackBlockHeader* header    = (StackBlockHeader*) memBlock - 1;
+    bool              mapped    = header->mappedSize > 0;
+    bool              shouldMap = stackShouldMapBlock(&stack->memoryPolicy, size);
+
+    if (!mapped && !shouldMap)
     {
-        stack->errorStatus = STACK_POP_FROM_EMPTY;
-        ASSERT_STACK_OK(stack);
+        header = (StackBlockHeader*) realloc(header, sizeof(StackBlockHeader) + size);
+
+        if (header == NULL)
+        {
+            return NULL;
+        }
+
+        header->blockSize = size;
+
+        return header + 1;
     }
 
-    stack->size--;
-    elem_t returnValue = stack->dynamicArray[stack->size];
+    if (mapped && shouldMap && sizeof(StackBlockHeader) + size <= header->mappedSize)
+    {
+        header->blockSize = size;
 
-    PUT_POISON(stack->dynamicArray + stack->size, stack->dynamicArray + stack->size + 1);
-    STACK_UPDATE_HASH(stack);
-    ASSERT_STACK_OK(stack);
+        return memBlock;
+    }
 
-    return returnValue;
+    void* newMemBlock = allocateBlock(stack, size);
+
+    if (newMemBlock != NULL)
+    {
+        memcpy(newMemBlock, memBlock, size < header->blockSize ? size : header->blockSize);
+        freeBlock(memBlock);
+    }
+
+    return newMemBlock;
+    #else
+    return realloc(memBlock, size);
+    #endif
 }
 
 //-----------------------------------------------------------------------------
-//! Returns the element on top of the stack. Undefined behavior if the stack 
-//! is empty!
-//!
-//! @param [out]  stack    
+//! Allocates dynamic array of capacity elements, sets its canaries and puts
+//! POISON in all of its elements. Hash isn't computed as it depends on the 
+//! stack's size.
 //!
-//! @note if top is called from an empty stack then sets the stack's 
-//!       errorStatus to TOP_FROM_EMPTY.
+//! @param [in]  stack  whose memory policy is used
+//! @param [in]  capacity  
 //!
-//! @return the element on top of the stack.
+//! @return allocated array or NULL if allocation failed.
 //-----------------------------------------------------------------------------
-elem_t stackTop(Stack* stack)
+elem_t* allocateArray(Stack* stack, size_t capacity)
 {
-    ASSERT_STACK_OK(stack);
+    elem_t* array = arrayFromBlock(allocateBlock(stack, arrayBlockSize(capacity)));
 
-    if (stack->size == 0)
+    if (array != NULL)
     {
-        stack->errorStatus = STACK_TOP_FROM_EMPTY;
-        ASSERT_STACK_OK(stack);
+        SET_CANARIES((void*)array, capacity * sizeof(elem_t), STACK_ARRAY_CANARY_L, STACK_ARRAY_CANARY_R);
+        PUT_POISON(array, array + capacity);
     }
 
-    return stack->dynamicArray[stack->size - 1];
+    return array;
 }
 
 //-----------------------------------------------------------------------------
-//! Empties stack.
+//! Frees dynamic array allocated by allocateArray() or resizeArray().
 //!
-//! @param [out]  stack    
+//! @param [in]  array  
 //-----------------------------------------------------------------------------
-void stackClear(Stack* stack)
+void freeArray(elem_t* array)
 {
-    ASSERT_STACK_OK(stack);
+    freeBlock(arrayBlockBegin(array));
+}
+
+#ifdef STACK_SPILL_ENABLED
+// Elements, chunks are read into arrays on the stack
+static const size_t STACK_SPILL_READ_CHUNK = 512;
+
+struct StackSpillFile
+{
+    size_t refCount = 0;
+    FILE*  file     = NULL;
+    size_t end      = 0;
+};
 
-    stack->size = 0;
+//-----------------------------------------------------------------------------
+//! @return new temporary spill file with one reference or NULL if it couldn't 
+//!         be created. The file is deleted when closed.
+//-----------------------------------------------------------------------------
+StackSpillFile* stackSpillFileCreate()
+{
+    StackSpillFile* spillFile = (StackSpillFile*) calloc(1, sizeof(StackSpillFile));
 
-    if (!stackShrinkToFit(stack))
+    if (spillFile == NULL)
     {
-        stack->errorStatus = STACK_REALLOCATION_FAILED;
-        ASSERT_STACK_OK(stack);
+        return NULL;
     }
 
-    PUT_POISON(stack->dynamicArray, stack->dynamicArray + stack->capacity);
-    STACK_UPDATE_HASH(stack);
-    ASSERT_STACK_OK(stack);
+    spillFile->file = tmpfile();
+
+    if (spillFile->file == NULL)
+    {
+        free(spillFile);
+        return NULL;
+    }
+
+    spillFile->refCount = 1;
+
+    return spillFile;
 }
 
 //-----------------------------------------------------------------------------
-//! Resizes stack's array to max(stack's size, MINIMAL_STACK_CAPACITY). If 
-//! reallocation was unsuccessful, returns false, sets stack's errorStatus to 
-//! REALLOCATION_FAILED, but current elements of the stack won't be removed.
-//!
-//! @param [out]  stack   
+//! Drops a reference to spillFile, closing it when it is no longer referenced.
 //!
-//! @return whether or not shrinking was successful.
+//! @param [out]  spillFile  
 //-----------------------------------------------------------------------------
-bool stackShrinkToFit(Stack* stack)
+void stackSpillFileRelease(StackSpillFile* spillFile)
 {
-    ASSERT_STACK_OK(stack);
-
-    if (stack->capacity <= MINIMAL_STACK_CAPACITY)
+    if (spillFile != NULL && --spillFile->refCount == 0)
     {
-        return false;
+        fclose(spillFile->file);
+        free(spillFile);
     }
+}
 
-    elem_t* newDynamicArray = resizeArray(stack, stack->size);
-    if (newDynamicArray == NULL)
+//-----------------------------------------------------------------------------
+//! Writes size bytes of data to spillFile at offset, retrying partial writes.
+//!
+//! @param [in]  spillFile  
+//! @param [in]  data  
+//! @param [in]  size  
+//! @param [in]  offset  
+//!
+//! @return whether or not all the data was written.
+//-----------------------------------------------------------------------------
+bool stackSpillWrite(StackSpillFile* spillFile, const void* data, size_t size, size_t offset)
+{
+    const char* bytes = (const char*) data;
+
+    while (size > 0)
     {
-        stack->errorStatus = STACK_REALLOCATION_FAILED;
-        ASSERT_STACK_OK(stack);
-        return false;
-    }
+        ssize_t written = pwrite(fileno(spillFile->file), bytes, size, (off_t) offset);
 
-    STACK_UPDATE_HASH(stack);
-    ASSERT_STACK_OK(stack);
+        if (written < 0 && errno == EINTR)
+        {
+            continue;
+        }
+
+        if (written <= 0)
+        {
+            return false;
+        }
+
+        bytes  += written;
+        size   -= (size_t) written;
+        offset += (size_t) written;
+    }
 
     return true;
 }
 
 //-----------------------------------------------------------------------------
-//! Checks whether or not stack is working correctly.
+//! Reads size bytes from spillFile at offset to data, retrying partial reads.
 //!
-//! @param [out]  stack   
+//! @param [in]   spillFile  
+//! @param [out]  data  
+//! @param [in]   size  
+//! @param [in]   offset  
 //!
-//! @return whether or not stack is working correctly.
+//! @return whether or not all the data was read.
 //-----------------------------------------------------------------------------
-bool stackOk(Stack* stack)
+bool stackSpillReadBytes(StackSpillFile* spillFile, void* data, size_t size, size_t offset)
 {
-    assert(stack != NULL);
+    char* bytes = (char*) data;
 
-    if (stack == NULL)
+    while (size > 0)
     {
-        return false;
-    }
+        ssize_t read = pread(fileno(spillFile->file), bytes, size, (off_t) offset);
 
-    if (stack->errorStatus != STACK_NO_ERROR)
-    {
-        return false;
-    }
+        if (read < 0 && errno == EINTR)
+        {
+            continue;
+        }
 
-    if (stack->status == STACK_STATUS_NOT_CONSTRUCTED)
-    {
-        stack->errorStatus = STACK_NOT_CONSTRUCTED_USE;
-        return false;
-    }
+        if (read <= 0)
+        {
+            return false;
+        }
 
-    if (stack->status == STACK_STATUS_DESTRUCTED)
-    {
-        stack->errorStatus = STACK_DESTRUCTED_USE;
-        return false;
+        bytes  += read;
+        size   -= (size_t) read;
+        offset += (size_t) read;
     }
 
-    if (stack->size < 0 || stack->size > stack->capacity)
-    {
-        stack->errorStatus = STACK_MEMORY_CORRUPTION;
-        return false;
-    }
+    return true;
+}
 
-    if (stack->dynamicArray == NULL)
+struct StackSpillReader
+{
+    const StackSegment* segment  = NULL;
+    size_t              position = 0;
+    uint32_t            checksum = 0;
+};
+
+//-----------------------------------------------------------------------------
+//! @param [in]  segment  spilled segment
+//!
+//! @return reader of segment's elements starting from the bottom one.
+//-----------------------------------------------------------------------------
+StackSpillReader stackSpillReader(const StackSegment* segment)
+{
+    StackSpillReader reader = {};
+    reader.segment  = segment;
+    reader.checksum = (uint32_t) segment->size;
+
+    return reader;
+}
+
+//-----------------------------------------------------------------------------
+//! Reads next count elements of reader's segment to buffer.
+//!
+//! @param [out]  reader  
+//! @param [out]  buffer  
+//! @param [in]   count  
+//!
+//! @return whether or not the elements were read.
+//-----------------------------------------------------------------------------
+bool stackSpillReadNext(StackSpillReader* reader, elem_t* buffer, size_t count)
+{
+    if (!stackSpillReadBytes(reader->segment->spillFile, buffer, count * sizeof(elem_t), 
+                             reader->segment->spillOffset + reader->position * sizeof(elem_t)))
     {
-        stack->errorStatus = STACK_MEMORY_CORRUPTION;
         return false;
     }
 
-    #ifdef STACK_POISON
-    if (!stackCheckPoison(stack))
+    reader->checksum  = computeHash(buffer, count * sizeof(elem_t), reader->checksum);
+    reader->position += count;
+
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+//! Reads the rest of reader's segment and validates its checksum.
+//!
+//! @param [out]  reader  
+//!
+//! @return whether or not the segment was read and the checksum matched.
+//-----------------------------------------------------------------------------
+bool stackSpillReadEnd(StackSpillReader* reader)
+{
+    elem_t chunk[STACK_SPILL_READ_CHUNK];
+
+    while (reader->position < reader->segment->size)
     {
-        return false;
+        size_t remaining = reader->segment->size - reader->position;
+
+        if (!stackSpillReadNext(reader, chunk, remaining < STACK_SPILL_READ_CHUNK ? remaining : STACK_SPILL_READ_CHUNK))
+        {
+            return false;
+        }
     }
-    #endif
 
-    #ifdef STACK_CANARIES_ENABLED
-    if (!stackCheckCanaries(stack))
+    return reader->checksum == reader->segment->spillChecksum;
+}
+
+//-----------------------------------------------------------------------------
+//! Reads elements [begin, begin + count) of spilled segment to destination.
+//! The whole segment is read to validate its checksum.
+//!
+//! @param [in]   segment  
+//! @param [in]   begin  
+//! @param [in]   count  
+//! @param [out]  destination  
+//!
+//! @return whether or not the elements were read and the checksum matched.
+//-----------------------------------------------------------------------------
+bool stackSpillRead(const StackSegment* segment, size_t begin, size_t count, elem_t* destination)
+{
+    StackSpillReader reader = stackSpillReader(segment);
+    elem_t           chunk[STACK_SPILL_READ_CHUNK];
+
+    while (reader.position < begin)
     {
-        return false;
+        size_t skipped = begin - reader.position;
+
+        if (!stackSpillReadNext(&reader, chunk, skipped < STACK_SPILL_READ_CHUNK ? skipped : STACK_SPILL_READ_CHUNK))
+        {
+            return false;
+        }
     }
-    #endif
 
-    #ifdef STACK_ARRAY_HASHING
-    if (!stackCheckHash(stack))
+    return stackSpillReadNext(&reader, destination, count) && stackSpillReadEnd(&reader);
+}
+
+//-----------------------------------------------------------------------------
+//! Releases segment's part of its spill file, truncating the file if the 
+//! part is at its end, and drops the reference to the file.
+//!
+//! @param [out]  segment  
+//-----------------------------------------------------------------------------
+void stackSpillRelease(StackSegment* segment)
+{
+    StackSpillFile* spillFile = segment->spillFile;
+
+    if (segment->spillOffset + segment->size * sizeof(elem_t) == spillFile->end)
     {
-        return false;
+        // If truncation fails the chunk is just left unused in the file
+        if (ftruncate(fileno(spillFile->file), (off_t) segment->spillOffset) == 0)
+        {
+            spillFile->end = segment->spillOffset;
+        }
     }
-    #endif
 
-    return true;
+    stackSpillFileRelease(spillFile);
 }
+#endif
 
-#define STACK_ERROR_STRING(errorStatus) #errorStatus
-static size_t STACK_DUMP_ERROR_NAME_STARTING_INDEX = 9;
-static size_t STACK_DUMP_ERROR_STRING_LENGTH       = 128;
-#define STACK_DUMP_CAT_ERROR_NAME_TO_ERROR_STRING(errorStatus) snprintf(&errorString[STACK_DUMP_ERROR_NAME_STARTING_INDEX], \
-                                                                                     STACK_DUMP_ERROR_STRING_LENGTH,        \
-                                                                                     STACK_ERROR_STRING(errorStatus));
+#ifdef STACK_AGGREGATES_ENABLED
+    #define STACK_AGGREGATES_TRIM(stack, index) stackAggregatesTrim(stack, index)
 
 //-----------------------------------------------------------------------------
-//! Uses logGenerator to dump stack to html log file. 
+//! @param [in]  stack  
 //!
-//! @param [out]  stack   
+//! @return whether or not stack maintains aggregates of its elements.
 //-----------------------------------------------------------------------------
-void dump(Stack* stack)
+bool stackAggregated(const Stack* stack)
 {
-    assert(stack != NULL);
+    return stack->aggregates.tracks[0] != NULL;
+}
 
-    if (!LG_IsInitialized())
+//-----------------------------------------------------------------------------
+//! Drops stack's aggregates of elements from index up. Must be called before
+//! any of these elements is changed or removed. Dropped entries are poisoned.
+//!
+//! @param [out]  stack  
+//! @param [in]   index  
+//-----------------------------------------------------------------------------
+void stackAggregatesTrim(Stack* stack, size_t index)
+{
+    StackAggregates* aggregates = &stack->aggregates;
+
+    if (aggregates->size <= index)
     {
-        LG_Init();
+        return;
     }
 
-    char errorString[STACK_DUMP_ERROR_STRING_LENGTH];
-    if (stack->errorStatus == STACK_NO_ERROR)
+    for (size_t track = 0; track < STACK_TRACKS_COUNT; track++)
     {
-        snprintf(errorString, STACK_DUMP_ERROR_STRING_LENGTH, STACK_ERROR_STRING(STACK_NO_ERROR));
+        PUT_POISON(aggregates->tracks[track] + index, aggregates->tracks[track] + aggregates->size);
+    }
+
+    aggregates->size = index;
+}
+
+//-----------------------------------------------------------------------------
+//! Computes aggregates of the first element of dynamicArray they don't cover
+//! yet from those of the elements below it.
+//!
+//! @param [out]  stack  
+//-----------------------------------------------------------------------------
+void stackAggregatesAppend(Stack* stack)
+{
+    StackAggregates* aggregates = &stack->aggregates;
+    elem_t**         tracks     = aggregates->tracks;
+    size_t           index      = aggregates->size;
+    elem_t           value      = stack->dynamicArray[index];
+
+    elem_t min          = index > 0 ? tracks[STACK_TRACK_MIN][index - 1]          : INFINITY;
+    elem_t max          = index > 0 ? tracks[STACK_TRACK_MAX][index - 1]          : -INFINITY;
+    elem_t sum          = index > 0 ? tracks[STACK_TRACK_SUM][index - 1]          : 0;
+    elem_t compensation = index > 0 ? tracks[STACK_TRACK_COMPENSATION][index - 1] : 0;
+
+    // Neumaier's variant of Kahan summation, the compensation is left as it 
+    // is once the sum isn't finite, as it would turn into NaN
+    elem_t total = sum + value;
+    if (isfinite(total))
+    {
+        compensation += fabs(sum) >= fabs(value) ? (sum - total) + value : (value - total) + sum;
+    }
+
+    tracks[STACK_TRACK_MIN][index]          = fmin(min, value);
+    tracks[STACK_TRACK_MAX][index]          = fmax(max, value);
+    tracks[STACK_TRACK_SUM][index]          = total;
+    tracks[STACK_TRACK_COMPENSATION][index] = compensation;
+
+    aggregates->size++;
+}
+
+//-----------------------------------------------------------------------------
+//! Reallocates stack's aggregate tracks (or allocates them, if there are none)
+//! with stack's capacity. All tracks are allocated before any is replaced, so
+//! on failure the old ones are kept intact.
+//!
+//! @param [out]  stack  
+//!
+//! @return whether or not tracks were reallocated successfully.
+//-----------------------------------------------------------------------------
+bool stackAggregatesResize(Stack* stack)
+{
+    StackAggregates* aggregates = &stack->aggregates;
+
+    if (aggregates->capacity == stack->capacity)
+    {
+        return true;
+    }
+
+    elem_t* newTracks[STACK_TRACKS_COUNT] = {};
+
+    for (size_t track = 0; track < STACK_TRACKS_COUNT; track++)
+    {
+        newTracks[track] = allocateArray(stack, stack->capacity);
+
+        if (newTracks[track] == NULL)
+        {
+            for (size_t allocated = 0; allocated < track; allocated++)
+            {
+                freeArray(newTracks[allocated]);
+            }
+
+            return false;
+        }
+    }
+
+    STACK_AGGREGATES_TRIM(stack, stack->size < stack->capacity ? stack->size : stack->capacity);
+
+    for (size_t track = 0; track < STACK_TRACKS_COUNT; track++)
+    {
+        if (aggregates->tracks[track] != NULL)
+        {
+            memcpy(newTracks[track], aggregates->tracks[track], aggregates->size * sizeof(elem_t));
+            freeArray(aggregates->tracks[track]);
+        }
+
+        aggregates->tracks[track] = newTracks[track];
+    }
+
+    aggregates->capacity = stack->capacity;
+
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+//! Frees stack's aggregate tracks, which turns aggregates off.
+//!
+//! @param [out]  stack  
+//-----------------------------------------------------------------------------
+void stackAggregatesFree(Stack* stack)
+{
+    StackAggregates* aggregates = &stack->aggregates;
+
+    for (size_t track = 0; track < STACK_TRACKS_COUNT; track++)
+    {
+        if (aggregates->tracks[track] != NULL)
+        {
+            PUT_POISON(aggregates->tracks[track], aggregates->tracks[track] + aggregates->capacity);
+            freeArray(aggregates->tracks[track]);
+        }
+
+        aggregates->tracks[track] = NULL;
+    }
+
+    aggregates->size     = 0;
+    aggregates->capacity = 0;
+}
+
+#else
+    #define STACK_AGGREGATES_TRIM(stack, index) 
+#endif
+
+//-----------------------------------------------------------------------------
+//! Drops a reference to segment, freeing it and, recursively, its parents 
+//! when they are no longer referenced.
+//!
+//! @param [out]  segment  
+//-----------------------------------------------------------------------------
+void stackSegmentRelease(StackSegment* segment)
+{
+    // stackRegistryUsage() may be walking the segments about to be freed
+    STACK_REGISTRY_QUIESCE();
+
+    while (segment != NULL && --segment->refCount == 0)
+    {
+        StackSegment* parent = segment->parent;
+
+        #ifdef STACK_COMPRESSION_ENABLED
+        if (segment->compressed != NULL)
+        {
+            free(segment->compressed);
+        }
+        else
+        #endif
+
+        #ifdef STACK_SPILL_ENABLED
+        if (segment->spillFile != NULL)
+        {
+            stackSpillRelease(segment);
+        }
+        else
+        #endif
+
+        freeArray(segment->dynamicArray);
+        free(segment);
+
+        segment = parent;
+    }
+}
+
+//-----------------------------------------------------------------------------
+//! Drops all stack's frozen elements.
+//!
+//! @param [out]  stack  
+//-----------------------------------------------------------------------------
+void stackReleaseFrozen(Stack* stack)
+{
+    stackSegmentRelease(stack->frozen);
+
+    stack->frozen     = NULL;
+    stack->frozenSize = 0;
+}
+
+//-----------------------------------------------------------------------------
+//! Stack's constructor. Allocates max(capacity, MINIMAL_STACK_CAPACITY) 
+//! objects of type elem_t.
+//!
+//! @param [out]  stack  
+//! @param [in]   capacity   
+//!
+//! @note if calloc returned NULL then sets stack's errorStatus to 
+//!       INITIALIZATION_FAILED.
+//!
+//! @return stack if constructed successfully or NULL otherwise.
+//-----------------------------------------------------------------------------
+#ifdef STACK_DEBUG_MODE
+Stack* fstackConstruct(Stack* stack, size_t capacity, const char* stackName)
+#else
+Stack* fstackConstruct(Stack* stack, size_t capacity)
+#endif
+{
+    assert(stack != NULL);
+    assert(capacity > 0);
+
+    #ifdef STACK_DEBUG_MODE
+    stack->name = stackName;
+    #endif
+
+    stack->size         = 0;
+    stack->capacity     = capacity > MINIMAL_STACK_CAPACITY ? capacity : MINIMAL_STACK_CAPACITY;
+
+    stack->dynamicArray = allocateArray(stack, stack->capacity);
+
+    if (stack->dynamicArray == NULL) 
+    {
+        stack->errorStatus = STACK_CONSTRUCTION_FAILED;
+        ASSERT_STACK_OK_OR_RETURN(stack, NULL);
+        return NULL;
+    }
+
+    STACK_UPDATE_HASH(stack);
+
+    stack->status = STACK_STATUS_CONSTRUCTED;
+    STACK_REGISTRY_ENROLL(stack);
+    ASSERT_STACK_OK_OR_RETURN(stack, NULL);
+
+    return stack;
+}
+
+//-----------------------------------------------------------------------------
+//! Stack's constructor. Allocates DEFAULT_STACK_CAPACITY objects of type 
+//! elem_t.
+//!
+//! @param [out]  stack   
+//!
+//! @note if calloc returned NULL then sets stack's errorStatus to 
+//!       INITIALIZATION_FAILED.
+//!
+//! @return stack if constructed successfully or NULL otherwise.
+//-----------------------------------------------------------------------------
+#ifdef STACK_DEBUG_MODE
+Stack* fstackConstruct(Stack* stack, const char* stackName)
+#else
+Stack* fstackConstruct(Stack* stack)
+#endif
+{
+    #ifdef STACK_DEBUG_MODE
+    stack = fstackConstruct(stack, DEFAULT_STACK_CAPACITY, stackName);
+    #else
+    stack = fstackConstruct(stack, DEFAULT_STACK_CAPACITY);
+    #endif
+
+    ASSERT_STACK_OK_OR_RETURN(stack, NULL);
+
+    return stack;
+}
+
+//-----------------------------------------------------------------------------
+//! Allocates a Stack, calls constructor and returns the pointer to this Stack.
+//!
+//! @param [in]  capacity   
+//!
+//! @note if calloc returned NULL then sets stack's errorStatus to 
+//!       INITIALIZATION_FAILED.
+//! @note if capacity is less than MINIMAL_STACK_CAPACITY, than sets capacity
+//!       to MINIMAL_STACK_CAPACITY.
+//!
+//! @return stack if constructed successfully or NULL otherwise.
+//-----------------------------------------------------------------------------
+Stack* newStack(size_t capacity)
+{
+    assert(capacity > 0);
+
+    Stack* newStack = (Stack*) calloc(1, sizeof(Stack));
+    if (newStack == NULL)
+    {
+        return NULL;
+    }
+
+    // Default member initializers (e.g. struct canaries) aren't applied by calloc
+    new (newStack) Stack();
+
+    #ifdef STACK_DEBUG_MODE
+    fstackConstruct(newStack, capacity, DYNAMICALLY_CREATED_STACK_NAME);
+    #else
+    fstackConstruct(newStack, capacity);
+    #endif
+
+    return newStack;
+}
+
+//-----------------------------------------------------------------------------
+//! Allocates a Stack, calls constructor and returns the pointer to this Stack.
+//!
+//! @note if calloc returned NULL then sets stack's errorStatus to 
+//!       INITIALIZATION_FAILED.
+//! @note starting capacity is DEFAULT_STACK_CAPACITY
+//!
+//! @return stack if constructed successfully or NULL otherwise.
+//-----------------------------------------------------------------------------
+Stack* newStack()
+{
+    return newStack(DEFAULT_STACK_CAPACITY);
+}
+
+//-----------------------------------------------------------------------------
+//! Stack's destructor. Calls free for stack's dynamicArray.
+//!
+//! @param [out]  stack   
+//-----------------------------------------------------------------------------
+void stackDestruct(Stack* stack)
+{
+    #ifdef STACK_NON_FATAL_ERRORS
+    // A pending recoverable error must not keep the stack from being released.
+    if (stack != NULL)
+    {
+        stackClearError(stack);
+    }
+    #endif
+
+    ASSERT_STACK_OK(stack);
+
+    #ifdef STACK_SCRUBBER_ENABLED
+    stackScrubberRemove(stack);
+    #endif
+
+    STACK_REGISTRY_REMOVE(stack);
+    PUT_POISON(stack->dynamicArray, stack->dynamicArray + stack->capacity);
+
+    freeArray(stack->dynamicArray);
+    stackReleaseFrozen(stack);
+    free(stack->marks);
+
+    #ifdef STACK_AGGREGATES_ENABLED
+    stackAggregatesFree(stack);
+    #endif
+
+    #ifdef STACK_SPILL_ENABLED
+    stackSpillFileRelease(stack->spillFile);
+    stack->spillFile = NULL;
+    #endif
+
+    stack->marks         = NULL;
+    stack->marksCount    = 0;
+    stack->marksCapacity = 0;
+
+    stack->size         = 0;
+    stack->capacity     = 0;
+    stack->dynamicArray = NULL;
+
+    stack->status = STACK_STATUS_DESTRUCTED;
+}
+
+//-----------------------------------------------------------------------------
+//! Calls destructor of stack and free of stack. Undefined behavior if stack
+//! wasn't created dynamically using newStack() or an allocator.
+//!
+//! @param [out]  stack   
+//-----------------------------------------------------------------------------
+void deleteStack(Stack* stack)
+{
+    #ifdef STACK_NON_FATAL_ERRORS
+    // A pending recoverable error must not keep the stack from being released.
+    if (stack != NULL)
+    {
+        stackClearError(stack);
+    }
+    #endif
+
+    ASSERT_STACK_OK(stack);
+
+    stackDestruct(stack);
+
+    free(stack);
+}
+
+//-----------------------------------------------------------------------------
+//! @param [in]  stack   
+//!
+//! @return current size of stack.
+//-----------------------------------------------------------------------------
+size_t fstackSize(Stack* stack)
+{
+    ASSERT_STACK_OK_OR_RETURN(stack, 0);
+
+    return stack->frozenSize + stack->size;
+}
+
+//-----------------------------------------------------------------------------
+//! @param [in]  stack   
+//!
+//! @return current capacity of stack.
+//-----------------------------------------------------------------------------
+size_t stackCapacity(Stack* stack)
+{
+    ASSERT_STACK_OK_OR_RETURN(stack, 0);
+
+    return stack->capacity;
+}
+
+#ifdef STACK_SCRUBBER_ENABLED
+//-----------------------------------------------------------------------------
+//! Moves an error found by the scrubber to stack's errorStatus. Must be called
+//! from the thread owning the stack.
+//!
+//! @param [out]  stack   
+//-----------------------------------------------------------------------------
+void stackTakeScrubError(Stack* stack)
+{
+    StackErrors scrubError = stack->scrubError.exchange(STACK_NO_ERROR, std::memory_order_acquire);
+
+    if (scrubError != STACK_NO_ERROR && stack->errorStatus == STACK_NO_ERROR)
+    {
+        stack->errorStatus = scrubError;
+    }
+}
+#endif
+
+//-----------------------------------------------------------------------------
+//! @param [in]  stack   
+//!
+//! @return current stack's errorStatus.
+//-----------------------------------------------------------------------------
+StackErrors stackErrorStatus (Stack* stack)
+{
+    assert(stack != NULL);
+
+    #ifdef STACK_SCRUBBER_ENABLED
+    stackTakeScrubError(stack);
+    #endif
+
+    return stack->errorStatus;
+}
+
+//-----------------------------------------------------------------------------
+//! @param [in]  errorStatus   of a stack that failed a check
+//!
+//! @return status returned by StackErrors functions of such a stack.
+//-----------------------------------------------------------------------------
+StackErrors failureStatus(StackErrors errorStatus)
+{
+    return errorStatus == STACK_NO_ERROR ? STACK_NOT_CONSTRUCTED_USE : errorStatus;
+}
+
+//-----------------------------------------------------------------------------
+//! @param [in]  stack   
+//!
+//! @return status returned by StackErrors functions if stack failed the 
+//!         check in ASSERT_STACK_OK_OR_RETURN.
+//-----------------------------------------------------------------------------
+StackErrors stackFailureStatus(Stack* stack)
+{
+    return stack == NULL ? STACK_NOT_CONSTRUCTED_USE : failureStatus(stack->errorStatus);
+}
+
+//-----------------------------------------------------------------------------
+//! @param [in]  error   
+//!
+//! @return whether or not error leaves the stack intact, i.e. it is 
+//!         POP_FROM_EMPTY, TOP_FROM_EMPTY, REALLOCATION_FAILED, 
+//!         MODIFIED_WHILE_VIEWED, INVALID_MARK, NOT_ENOUGH_OPERANDS, 
+//!         SPILL_FAILED, VIEW_OF_FROZEN or DOMAIN_ERROR.
+//-----------------------------------------------------------------------------
+bool stackErrorRecoverable(StackErrors error)
+{
+    switch (error)
+    {
+        case STACK_POP_FROM_EMPTY:
+        case STACK_TOP_FROM_EMPTY:
+        case STACK_REALLOCATION_FAILED:
+        case STACK_MODIFIED_WHILE_VIEWED:
+        case STACK_INVALID_MARK:
+        case STACK_NOT_ENOUGH_OPERANDS:
+        case STACK_SPILL_FAILED:
+        case STACK_VIEW_OF_FROZEN:
+        case STACK_DOMAIN_ERROR:
+        {
+            return true;
+        }
+
+        default:
+        {
+            return false;
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+//! Resets errorStatus to NO_ERROR if it is recoverable.
+//!
+//! @param [out]  errorStatus   
+//!
+//! @return whether or not there is no error after the call.
+//-----------------------------------------------------------------------------
+bool clearRecoverableError(StackErrors* errorStatus)
+{
+    if (stackErrorRecoverable(*errorStatus))
+    {
+        *errorStatus = STACK_NO_ERROR;
+    }
+
+    return *errorStatus == STACK_NO_ERROR;
+}
+
+//-----------------------------------------------------------------------------
+//! Resets stack's errorStatus to NO_ERROR if the error left the stack intact,
+//! i.e. it is POP_FROM_EMPTY, TOP_FROM_EMPTY, REALLOCATION_FAILED, 
+//! MODIFIED_WHILE_VIEWED, INVALID_MARK, NOT_ENOUGH_OPERANDS, SPILL_FAILED 
+//! (the unreadable elements stay spilled), VIEW_OF_FROZEN or DOMAIN_ERROR. 
+//! With STACK_NON_FATAL_ERRORS a stack refuses any operation until this is 
+//! done.
+//!
+//! @param [out]  stack   
+//!
+//! @return whether or not stack has no error after the call.
+//-----------------------------------------------------------------------------
+bool stackClearError(Stack* stack)
+{
+    assert(stack != NULL);
+
+    return clearRecoverableError(&stack->errorStatus);
+}
+
+//-----------------------------------------------------------------------------
+//! Resizes stack's array to newCapacity. If reallocation was unsuccessful, 
+//! returns NULL, sets stack's errorStatus to REALLOCATION_FAILED, but current
+//! elements of the stack won't be removed.
+//!
+//! @param [out]  stack   
+//! @param [in]   newCapacity   
+//!
+//! @note if newCapacity is less than stack's size then there will be DATA 
+//!       LOSS!
+//!
+//! @return pointer to the new stack's array if reallocation was successful 
+//!         or NULL otherwise.
+//-----------------------------------------------------------------------------
+elem_t* resizeArray(Stack* stack, size_t newCapacity)
+{
+    elem_t* newDynamicArray = NULL;
+    ASSERT_STACK_OK_OR_RETURN(stack, NULL);
+
+    #ifdef STACK_SCRUBBER_ENABLED
+    void* retiredBlock = NULL;
+
+    // The scrubber may be reading the old block right now, so instead of 
+    // realloc the block is copied and freed only after the current scrub pass.
+    if (stack->scrubbed)
+    {
+        size_t copiedCapacity = newCapacity < stack->capacity ? newCapacity : stack->capacity;
+
+        retiredBlock    = arrayBlockBegin(stack->dynamicArray);
+        newDynamicArray = arrayFromBlock(allocateBlock(stack, arrayBlockSize(newCapacity)));
+
+        if (newDynamicArray != NULL)
+        {
+            memcpy(arrayBlockBegin(newDynamicArray), retiredBlock, arrayBlockSize(copiedCapacity));
+        }
+    }
+    else
+    #endif
+
+    newDynamicArray = arrayFromBlock(reallocateBlock(stack, arrayBlockBegin(stack->dynamicArray), 
+                                                     arrayBlockSize(newCapacity)));
+
+    if (newDynamicArray == NULL)
+    {
+        stack->errorStatus = STACK_REALLOCATION_FAILED;
+        ASSERT_STACK_OK_OR_RETURN(stack, NULL);
+    }
+    else
+    {
+        STACK_WRITE_BEGIN(stack);
+
+        stack->dynamicArray = newDynamicArray;
+        stack->capacity     = newCapacity;
+
+        PUT_POISON(stack->dynamicArray + stack->size, stack->dynamicArray + stack->capacity);
+        SET_CANARY((void*)stack->dynamicArray, stack->capacity * sizeof(elem_t), STACK_ARRAY_CANARY_R, 'r');
+        STACK_UPDATE_HASH(stack);
+
+        STACK_WRITE_END(stack);
+
+        #ifdef STACK_AGGREGATES_ENABLED
+        // Tracks that can't follow are kept, aggregates stop being appended on
+        // push until stackAggregatesUpdate() reallocates them
+        if (stackAggregated(stack))
+        {
+            stackAggregatesResize(stack);
+        }
+        #endif
+
+        #ifdef STACK_SCRUBBER_ENABLED
+        if (retiredBlock != NULL)
+        {
+            stackScrubberRetire(retiredBlock);
+        }
+        #endif
+    }
+
+    return newDynamicArray;
+}
+
+//-----------------------------------------------------------------------------
+//! @param [in]  stack  
+//!
+//! @return top frozen element of the stack. Undefined behavior if there are
+//!         no frozen elements.
+//-----------------------------------------------------------------------------
+elem_t stackFrozenTop(Stack* stack)
+{
+    return stack->frozen->dynamicArray[stack->frozenSize - 1 - stack->frozen->parentSize];
+}
+
+//-----------------------------------------------------------------------------
+//! Truncates stack's frozen elements to newFrozenSize. The segments 
+//! themselves aren't modified, the stack just stops referencing the elements
+//! (and the segments it no longer has elements of).
+//!
+//! @param [out]  stack  
+//! @param [in]   newFrozenSize   must be not greater than stack's frozenSize
+//-----------------------------------------------------------------------------
+void stackFrozenTruncate(Stack* stack, size_t newFrozenSize)
+{
+    while (stack->frozen != NULL && stack->frozen->parentSize >= newFrozenSize)
+    {
+        StackSegment* segment = stack->frozen;
+        stack->frozen = segment->parent;
+
+        if (stack->frozen != NULL)
+        {
+            stack->frozen->refCount++;
+        }
+
+        stackSegmentRelease(segment);
+    }
+
+    stack->frozenSize = newFrozenSize;
+}
+
+//-----------------------------------------------------------------------------
+//! Removes top frozen element from the stack.
+//!
+//! @param [out]  stack  
+//-----------------------------------------------------------------------------
+void stackFrozenPop(Stack* stack)
+{
+    stackFrozenTruncate(stack, stack->frozenSize - 1);
+}
+
+//-----------------------------------------------------------------------------
+//! Drops stack's marks deeper than stack's current size. Marks are stored in
+//! order of non-decreasing depth, so only the last ones can become stale.
+//!
+//! @param [out]  stack  
+//-----------------------------------------------------------------------------
+void stackDropStaleMarks(Stack* stack)
+{
+    size_t size = stack->frozenSize + stack->size;
+
+    while (stack->marksCount > 0 && stack->marks[stack->marksCount - 1].depth > size)
+    {
+        stack->marksCount--;
+    }
+}
+
+#ifdef STACK_COMPRESSION_ENABLED
+static_assert(sizeof(elem_t) == sizeof(uint64_t), "XOR compression needs 64-bit elements");
+
+// Upper bound of bits per element: control bits, leading zeros count, 
+// meaningful bits count and the meaningful bits themselves.
+static const size_t STACK_XOR_MAX_ELEMENT_BITS = 2 + 5 + 6 + 64;
+static const size_t STACK_XOR_DECODE_CHUNK     = 512;
+
+struct StackBitStream
+{
+    uint8_t* data     = NULL;
+    size_t   bitCount = 0;
+};
+
+//-----------------------------------------------------------------------------
+//! Appends count lower bits of value to stream, most significant bit first.
+//! Stream's data must be zeroed beyond its bitCount.
+//!
+//! @param [out]  stream  
+//! @param [in]   value   
+//! @param [in]   count   not greater than 64
+//-----------------------------------------------------------------------------
+void writeBits(StackBitStream* stream, uint64_t value, unsigned count)
+{
+    while (count > 0)
+    {
+        unsigned available = 8 - stream->bitCount % 8;
+        unsigned taken     = count < available ? count : available;
+        unsigned bits      = (unsigned) (value >> (count - taken)) & ((1u << taken) - 1);
+
+        stream->data[stream->bitCount / 8] |= (uint8_t) (bits << (available - taken));
+        stream->bitCount += taken;
+        count            -= taken;
+    }
+}
+
+//-----------------------------------------------------------------------------
+//! @param [out]  stream  
+//! @param [in]   count   not greater than 64
+//!
+//! @return next count bits of stream.
+//-----------------------------------------------------------------------------
+uint64_t readBits(StackBitStream* stream, unsigned count)
+{
+    uint64_t value = 0;
+
+    while (count > 0)
+    {
+        unsigned available = 8 - stream->bitCount % 8;
+        unsigned taken     = count < available ? count : available;
+        unsigned byte      = stream->data[stream->bitCount / 8];
+
+        value = (value << taken) | ((byte >> (available - taken)) & ((1u << taken) - 1));
+        stream->bitCount += taken;
+        count            -= taken;
+    }
+
+    return value;
+}
+
+//-----------------------------------------------------------------------------
+//! @param [in]  value  must be nonzero
+//!
+//! @return number of leading zero bits of value.
+//-----------------------------------------------------------------------------
+unsigned countLeadingZeros(uint64_t value)
+{
+    #if defined(__GNUC__)
+    return __builtin_clzll(value);
+    #else
+    unsigned count = 0;
+    for (; !(value & (1ull << 63)); value <<= 1, count++);
+    return count;
+    #endif
+}
+
+//-----------------------------------------------------------------------------
+//! @param [in]  value  must be nonzero
+//!
+//! @return number of trailing zero bits of value.
+//-----------------------------------------------------------------------------
+unsigned countTrailingZeros(uint64_t value)
+{
+    #if defined(__GNUC__)
+    return __builtin_ctzll(value);
+    #else
+    unsigned count = 0;
+    for (; !(value & 1); value >>= 1, count++);
+    return count;
+    #endif
+}
+
+//-----------------------------------------------------------------------------
+//! Compresses array with Gorilla-style XOR encoding: each element is XORed 
+//! with the previous one and only the meaningful bits of the result are 
+//! stored, reusing the previous leading/trailing zeros window if possible.
+//!
+//! @param [in]   array  
+//! @param [in]   count  must be positive
+//! @param [out]  compressedSize  
+//!
+//! @return compressed data or NULL if allocation failed.
+//-----------------------------------------------------------------------------
+uint8_t* xorCompress(const elem_t* array, size_t count, size_t* compressedSize)
+{
+    StackBitStream stream = {};
+    stream.data = (uint8_t*) calloc(1, (count * STACK_XOR_MAX_ELEMENT_BITS + 7) / 8);
+
+    if (stream.data == NULL)
+    {
+        return NULL;
+    }
+
+    uint64_t previous = 0;
+    unsigned leading  = 64;
+    unsigned trailing = 0;
+
+    memcpy(&previous, array, sizeof(previous));
+    writeBits(&stream, previous, 64);
+
+    for (size_t i = 1; i < count; i++)
+    {
+        uint64_t current = 0;
+        memcpy(&current, array + i, sizeof(current));
+
+        uint64_t xored = current ^ previous;
+        previous = current;
+
+        if (xored == 0)
+        {
+            writeBits(&stream, 0, 1);
+            continue;
+        }
+
+        unsigned newLeading  = countLeadingZeros(xored);
+        unsigned newTrailing = countTrailingZeros(xored);
+
+        if (newLeading > 31)
+        {
+            newLeading = 31;
+        }
+
+        if (newLeading >= leading && newTrailing >= trailing)
+        {
+            writeBits(&stream, 2, 2);
+            writeBits(&stream, xored >> trailing, 64 - leading - trailing);
+            continue;
+        }
+
+        leading  = newLeading;
+        trailing = newTrailing;
+
+        unsigned meaningful = 64 - leading - trailing;
+
+        writeBits(&stream, 3, 2);
+        writeBits(&stream, leading, 5);
+        writeBits(&stream, meaningful % 64, 6);
+        writeBits(&stream, xored >> trailing, meaningful);
+    }
+
+    *compressedSize = (stream.bitCount + 7) / 8;
+
+    uint8_t* compressed = (uint8_t*) realloc(stream.data, *compressedSize);
+
+    return compressed != NULL ? compressed : stream.data;
+}
+
+struct StackXorDecoder
+{
+    StackBitStream stream   = {};
+    uint64_t       previous = 0;
+    unsigned       leading  = 0;
+    unsigned       trailing = 0;
+    size_t         decoded  = 0;
+};
+
+//-----------------------------------------------------------------------------
+//! Decodes count next elements of the data xorCompress() produced.
+//!
+//! @param [out]  decoder  
+//! @param [out]  array  
+//! @param [in]   count  
+//-----------------------------------------------------------------------------
+void xorDecompress(StackXorDecoder* decoder, elem_t* array, size_t count)
+{
+    for (size_t i = 0; i < count; i++, decoder->decoded++)
+    {
+        if (decoder->decoded == 0)
+        {
+            decoder->previous = readBits(&decoder->stream, 64);
+        }
+        else if (readBits(&decoder->stream, 1) == 1)
+        {
+            if (readBits(&decoder->stream, 1) == 1)
+            {
+                unsigned meaningful = 0;
+
+                decoder->leading = (unsigned) readBits(&decoder->stream, 5);
+                meaningful       = (unsigned) readBits(&decoder->stream, 6);
+                meaningful       = meaningful == 0 ? 64 : meaningful;
+                decoder->trailing = 64 - decoder->leading - meaningful;
+            }
+
+            decoder->previous ^= readBits(&decoder->stream, 64 - decoder->leading - decoder->trailing) << decoder->trailing;
+        }
+
+        memcpy(array + i, &decoder->previous, sizeof(decoder->previous));
+    }
+}
+
+#endif
+
+#ifdef STACK_PACKED_SEGMENTS
+//-----------------------------------------------------------------------------
+//! Extends count of top frozen elements to thaw so that it doesn't end in 
+//! the middle of a compressed or spilled segment, which would otherwise be 
+//! decoded or read again by the next thaw.
+//!
+//! @param [in]  stack  
+//! @param [in]  count  not greater than stack's frozenSize
+//!
+//! @return extended count.
+//-----------------------------------------------------------------------------
+size_t stackThawCount(Stack* stack, size_t count)
+{
+    size_t remaining = count;
+    size_t limit     = stack->frozenSize;
+
+    for (StackSegment* segment = stack->frozen; segment != NULL && remaining > 0; segment = segment->parent)
+    {
+        size_t inSegment = limit - segment->parentSize;
+
+        if (remaining <= inSegment)
+        {
+            return segment->dynamicArray == NULL ? count + inSegment - remaining : count;
+        }
+
+        remaining -= inSegment;
+        limit      = segment->parentSize;
+    }
+
+    return count;
+}
+#endif
+
+//-----------------------------------------------------------------------------
+//! Copies count elements of segment starting from begin to destination.
+//!
+//! @param [in]   segment  
+//! @param [in]   begin  
+//! @param [in]   count  
+//! @param [out]  destination  
+//!
+//! @return whether or not the elements were copied, which can only fail for
+//!         spilled segments.
+//-----------------------------------------------------------------------------
+bool stackSegmentCopy(const StackSegment* segment, size_t begin, size_t count, elem_t* destination)
+{
+    #ifdef STACK_COMPRESSION_ENABLED
+    if (segment->compressed != NULL)
+    {
+        StackXorDecoder decoder = {};
+        decoder.stream.data = segment->compressed;
+
+        elem_t chunk[STACK_XOR_DECODE_CHUNK];
+
+        while (decoder.decoded < begin)
+        {
+            size_t skipped = begin - decoder.decoded;
+            xorDecompress(&decoder, chunk, skipped < STACK_XOR_DECODE_CHUNK ? skipped : STACK_XOR_DECODE_CHUNK);
+        }
+
+        xorDecompress(&decoder, destination, count);
+        return true;
+    }
+    #endif
+
+    #ifdef STACK_SPILL_ENABLED
+    if (segment->spillFile != NULL)
+    {
+        return stackSpillRead(segment, begin, count, destination);
+    }
+    #endif
+
+    memcpy(destination, segment->dynamicArray + begin, count * sizeof(elem_t));
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+//! Copies count top frozen elements to the bottom of stack's dynamicArray, so
+//! that they can be modified in place. 
+//!
+//! @param [out]  stack  
+//! @param [in]   count  is reduced to stack's frozenSize if larger
+//!
+//! @note if realloc returned NULL then sets stack's errorStatus to 
+//!       REALLOCATION_FAILED, if a spilled segment couldn't be read back 
+//!       intact then sets it to SPILL_FAILED.
+//!
+//! @return whether or not elements were copied successfully.
+//-----------------------------------------------------------------------------
+bool stackThaw(Stack* stack, size_t count)
+{
+    if (count > stack->frozenSize)
+    {
+        count = stack->frozenSize;
+    }
+
+    if (count == 0)
+    {
+        return true;
+    }
+
+    #ifdef STACK_PACKED_SEGMENTS
+    count = stackThawCount(stack, count);
+    #endif
+
+    if (stack->capacity < stack->size + count && resizeArray(stack, stack->size + count) == NULL)
+    {
+        return false;
+    }
+
+    STACK_WRITE_BEGIN(stack);
+    STACK_AGGREGATES_TRIM(stack, 0);
+
+    memmove(stack->dynamicArray + count, stack->dynamicArray, stack->size * sizeof(elem_t));
+
+    size_t thawed = 0;
+
+    while (thawed < count)
+    {
+        StackSegment* segment = stack->frozen;
+        size_t        inSegment = stack->frozenSize - segment->parentSize;
+        size_t        taken     = count - thawed < inSegment ? count - thawed : inSegment;
+
+        if (!stackSegmentCopy(segment, inSegment - taken, taken, stack->dynamicArray + count - thawed - taken))
+        {
+            // Keep what was thawed so far, the segment stays frozen
+            memmove(stack->dynamicArray, stack->dynamicArray + count - thawed, (thawed + stack->size) * sizeof(elem_t));
+            PUT_POISON(stack->dynamicArray + thawed + stack->size, stack->dynamicArray + count + stack->size);
+
+            stack->errorStatus = STACK_SPILL_FAILED;
+            break;
+        }
+
+        thawed += taken;
+        stackFrozenTruncate(stack, stack->frozenSize - taken);
+    }
+
+    stack->size += thawed;
+
+    STACK_UPDATE_HASH(stack);
+    STACK_WRITE_END(stack);
+
+    return thawed == count;
+}
+
+#ifdef STACK_COMPRESSION_ENABLED
+//-----------------------------------------------------------------------------
+//! @param [in]  stack  
+//!
+//! @return memory taken by stack's frozen blocks made by stackCompressCold().
+//-----------------------------------------------------------------------------
+size_t stackColdBytes(const Stack* stack)
+{
+    return stack->frozen != NULL ? stack->frozen->coldBytes : 0;
+}
+#endif
+
+//-----------------------------------------------------------------------------
+//! Turns stack's dynamicArray into a new frozen segment on top of its current
+//! frozen elements and gives the stack an empty array.
+//!
+//! @param [out]  stack  
+//!
+//! @note if calloc returned NULL then sets stack's errorStatus to 
+//!       REALLOCATION_FAILED.
+//!
+//! @return whether or not the stack was frozen successfully.
+//-----------------------------------------------------------------------------
+bool stackFreeze(Stack* stack)
+{
+    if (stack->size == 0)
+    {
+        return true;
+    }
+
+    StackSegment* segment    = (StackSegment*) calloc(1, sizeof(StackSegment));
+    elem_t*       emptyArray = allocateArray(stack, MINIMAL_STACK_CAPACITY);
+
+    if (segment == NULL || emptyArray == NULL)
+    {
+        free(segment);
+
+        if (emptyArray != NULL)
+        {
+            freeArray(emptyArray);
+        }
+
+        stack->errorStatus = STACK_REALLOCATION_FAILED;
+        return false;
+    }
+
+    STACK_SCRUBBER_QUIESCE(stack, NULL);
+    STACK_WRITE_BEGIN(stack);
+    STACK_AGGREGATES_TRIM(stack, 0);
+
+    segment->refCount     = 1;
+    segment->parent       = stack->frozen;
+    segment->parentSize   = stack->frozenSize;
+    segment->dynamicArray = stack->dynamicArray;
+    segment->size         = stack->size;
+    segment->capacity     = stack->capacity;
+
+    #ifdef STACK_COMPRESSION_ENABLED
+    segment->coldBytes    = stackColdBytes(stack);
+    #endif
+
+    #ifdef STACK_SCRUBBER_ENABLED
+    // Segments aren't scrubbed, so they need the hash the scrubber kept for us
+    if (stack->scrubbed)
+    {
+        ARRAY_UPDATE_HASH(segment->dynamicArray, segment->size, segment->capacity);
+    }
+    #endif
+
+    stack->frozen       = segment;
+    stack->frozenSize  += stack->size;
+    stack->dynamicArray = emptyArray;
+    stack->capacity     = MINIMAL_STACK_CAPACITY;
+    stack->size         = 0;
+
+    STACK_UPDATE_HASH(stack);
+    STACK_WRITE_END(stack);
+
+    return true;
+}
+
+#ifdef STACK_COMPRESSION_ENABLED
+    #define STACK_COMPRESS_COLD(stack) stackCompressCold(stack)
+
+//-----------------------------------------------------------------------------
+//! Copies count elements into a new array of capacity count, for a frozen 
+//! segment that stores them as is.
+//!
+//! @param [in]  stack     whose memory policy is used
+//! @param [in]  elements  
+//! @param [in]  count     
+//!
+//! @return allocated array or NULL if allocation failed.
+//-----------------------------------------------------------------------------
+elem_t* stackFrozenArray(Stack* stack, const elem_t* elements, size_t count)
+{
+    elem_t* array = allocateArray(stack, count);
+
+    if (array != NULL)
+    {
+        memcpy(array, elements, count * sizeof(elem_t));
+
+        ARRAY_UPDATE_HASH(array, count, count);
+    }
+
+    return array;
+}
+
+//-----------------------------------------------------------------------------
+//! Compresses bottom elements of stack's dynamicArray into frozen segments of
+//! stack's compressionBlock elements each, leaving at least compressionBlock 
+//! elements in the array. Blocks that don't shrink (e.g. of random values) 
+//! are frozen uncompressed instead.
+//!
+//! @param [out]  stack  
+//!
+//! @note with a memory budget, the blocks take at most half of it, the rest
+//!       is left to the buffer and cold elements are spilled afterwards.
+//!
+//! @return whether or not any elements were compressed.
+//-----------------------------------------------------------------------------
+bool stackCompressCold(Stack* stack)
+{
+    #ifdef STACK_AGGREGATES_ENABLED
+    // Aggregated stacks keep all their elements in dynamicArray
+    if (stackAggregated(stack))
+    {
+        return false;
+    }
+    #endif
+
+    size_t block = stack->compressionBlock;
+
+    if (block == 0 || stack->size < 2 * block)
+    {
+        return false;
+    }
+
+    size_t blocksCount = (stack->size - block) / block;
+    size_t compressed  = 0;
+    size_t coldBudget  = SIZE_MAX;
+
+    #ifdef STACK_SPILL_ENABLED
+    if (stack->memoryBudget != 0)
+    {
+        coldBudget = stack->memoryBudget / 2;
+    }
+    #endif
+
+    if (stackColdBytes(stack) >= coldBudget)
+    {
+        return false;
+    }
+
+    STACK_WRITE_BEGIN(stack);
+
+    for (size_t i = 0; i < blocksCount; i++, compressed += block)
+    {
+        StackSegment* segment = (StackSegment*) calloc(1, sizeof(StackSegment));
+
+        if (segment == NULL)
+        {
+            break;
+        }
+
+        segment->compressed = xorCompress(stack->dynamicArray + compressed, block, &segment->compressedSize);
+
+        if (segment->compressed != NULL && segment->compressedSize >= block * sizeof(elem_t))
+        {
+            free(segment->compressed);
+
+            segment->compressed     = NULL;
+            segment->compressedSize = 0;
+            segment->dynamicArray   = stackFrozenArray(stack, stack->dynamicArray + compressed, block);
+        }
+
+        if (segment->compressed == NULL && segment->dynamicArray == NULL)
+        {
+            free(segment);
+            break;
+        }
+
+        segment->coldBytes = stackColdBytes(stack) + (segment->compressed != NULL ? segment->compressedSize 
+                                                                                   : arrayBlockSize(block));
+
+        if (segment->coldBytes > coldBudget)
+        {
+            if (segment->compressed != NULL)
+            {
+                free(segment->compressed);
+            }
+            else
+            {
+                freeArray(segment->dynamicArray);
+            }
+
+            free(segment);
+            break;
+        }
+
+        segment->refCount   = 1;
+        segment->parent     = stack->frozen;
+        segment->parentSize = stack->frozenSize;
+        segment->size       = block;
+        segment->capacity   = block;
+
+        #ifdef STACK_ARRAY_HASHING
+        if (segment->compressed != NULL)
+        {
+            segment->compressedHash = computeHash(segment->compressed, segment->compressedSize, stackHashBase(block, block));
+        }
+        #endif
+
+        stack->frozen      = segment;
+        stack->frozenSize += block;
+    }
+
+    if (compressed > 0)
+    {
+        memmove(stack->dynamicArray, stack->dynamicArray + compressed, (stack->size - compressed) * sizeof(elem_t));
+        PUT_POISON(stack->dynamicArray + stack->size - compressed, stack->dynamicArray + stack->size);
+
+        stack->size -= compressed;
+        STACK_UPDATE_HASH(stack);
+    }
+
+    STACK_WRITE_END(stack);
+
+    return compressed > 0;
+}
+
+#else
+    #define STACK_COMPRESS_COLD(stack) false
+#endif
+
+#ifdef STACK_SPILL_ENABLED
+    #define STACK_SPILL_COLD(stack) stackSpillCold(stack)
+
+//-----------------------------------------------------------------------------
+//! Makes stack start reading its top frozen segment ahead, if it is spilled,
+//! once a quarter of the segment's size is left in stack's own array.
+//!
+//! @param [out]  stack  
+//-----------------------------------------------------------------------------
+void stackSpillArmReadahead(Stack* stack)
+{
+    if (stack->frozen != NULL && stack->frozen->spillFile != NULL)
+    {
+        stack->spillReadahead = stack->frozen->size / 4;
+    }
+}
+
+//-----------------------------------------------------------------------------
+//! Keeps stack's buffer within stack's memoryBudget: grows it up to the 
+//! budget, then writes the bottom half of its elements to stack's spill file
+//! as a new frozen segment instead of growing further.
+//!
+//! @param [out]  stack  
+//!
+//! @return whether or not there is free space in the buffer now. If false,
+//!         the buffer should be grown as usual.
+//-----------------------------------------------------------------------------
+bool stackSpillCold(Stack* stack)
+{
+    #ifdef STACK_AGGREGATES_ENABLED
+    // Aggregated stacks keep all their elements in dynamicArray
+    if (stackAggregated(stack))
+    {
+        return false;
+    }
+    #endif
+
+    if (stack->memoryBudget == 0)
+    {
+        return false;
+    }
+
+    size_t budget = stack->memoryBudget;
+
+    #ifdef STACK_COMPRESSION_ENABLED
+    // What compressed blocks take is left out, see stackCompressCold()
+    budget = stackColdBytes(stack) < budget ? budget - stackColdBytes(stack) : 0;
+    #endif
+
+    size_t budgetCapacity = budget > arrayBlockSize(0) ? (budget - arrayBlockSize(0)) / sizeof(elem_t) : 0;
+
+    if (budgetCapacity < 2 * MINIMAL_STACK_CAPACITY)
+    {
+        budgetCapacity = 2 * MINIMAL_STACK_CAPACITY;
+    }
+
+    if (stack->capacity * STACK_EXPAND_MULTIPLIER <= budgetCapacity)
+    {
+        return false;
+    }
+
+    if (stack->capacity < budgetCapacity)
+    {
+        return resizeArray(stack, budgetCapacity) != NULL;
+    }
+
+    if (stack->spillFile == NULL && (stack->spillFile = stackSpillFileCreate()) == NULL)
+    {
+        return false;
+    }
+
+    StackSegment* segment = (StackSegment*) calloc(1, sizeof(StackSegment));
+    size_t        count   = stack->size / 2;
+    size_t        offset  = stack->spillFile->end;
+
+    if (segment == NULL || !stackSpillWrite(stack->spillFile, stack->dynamicArray, count * sizeof(elem_t), offset))
+    {
+        free(segment);
+        return false;
+    }
+
+    stack->spillFile->end += count * sizeof(elem_t);
+    stack->spillFile->refCount++;
+
+    segment->refCount      = 1;
+    segment->parent        = stack->frozen;
+    segment->parentSize    = stack->frozenSize;
+    segment->size          = count;
+    segment->capacity      = count;
+    segment->spillFile     = stack->spillFile;
+    segment->spillOffset   = offset;
+    segment->spillChecksum = computeHash(stack->dynamicArray, count * sizeof(elem_t), (uint32_t) count);
+
+    #ifdef STACK_COMPRESSION_ENABLED
+    segment->coldBytes     = stackColdBytes(stack);
+    #endif
+
+    STACK_WRITE_BEGIN(stack);
+
+    stack->frozen      = segment;
+    stack->frozenSize += count;
+
+    memmove(stack->dynamicArray, stack->dynamicArray + count, (stack->size - count) * sizeof(elem_t));
+    PUT_POISON(stack->dynamicArray + stack->size - count, stack->dynamicArray + stack->size);
+
+    stack->size -= count;
+
+    STACK_UPDATE_HASH(stack);
+    STACK_WRITE_END(stack);
+
+    stackSpillArmReadahead(stack);
+
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+//! Asks the system to read stack's top frozen segment ahead, if it is 
+//! spilled.
+//!
+//! @param [out]  stack  
+//-----------------------------------------------------------------------------
+void stackSpillReadahead(Stack* stack)
+{
+    #ifdef POSIX_FADV_WILLNEED
+    StackSegment* segment = stack->frozen;
+
+    if (segment != NULL && segment->spillFile != NULL)
+    {
+        posix_fadvise(fileno(segment->spillFile->file), (off_t) segment->spillOffset, 
+                      (off_t) (segment->size * sizeof(elem_t)), POSIX_FADV_WILLNEED);
+    }
+    #endif
+
+    stack->spillReadahead = 0;
+}
+#else
+    #define STACK_SPILL_COLD(stack) false
+#endif
+
+#ifdef STACK_PACKED_SEGMENTS
+//-----------------------------------------------------------------------------
+//! Decompresses or reads back the top frozen segment if stack's own array is
+//! empty and the segment is compressed or spilled, so that it can be popped 
+//! from.
+//!
+//! @param [out]  stack  
+//!
+//! @return whether or not stack's top element can be read in place.
+//-----------------------------------------------------------------------------
+bool stackThawPackedTop(Stack* stack)
+{
+    if (stack->size > 0 || stack->frozen == NULL || stack->frozen->dynamicArray != NULL)
+    {
+        return true;
+    }
+
+    if (!stackThaw(stack, 1))
+    {
+        return false;
+    }
+
+    #ifdef STACK_SPILL_ENABLED
+    stackSpillArmReadahead(stack);
+    #endif
+
+    return true;
+}
+#endif
+
+//-----------------------------------------------------------------------------
+//! Push value to stack.
+//!
+//! @param [out]  stack   
+//! @param [in]   value   
+//!
+//! @note if realloc returned NULL then sets stack's errorStatus to 
+//!       REALLOCATION_FAILED.
+//!
+//! @return NO_ERROR if pushed successfully or some STACK_ERRORS code 
+//!         otherwise.
+//-----------------------------------------------------------------------------
+StackErrors fstackPush(Stack* stack, elem_t value)
+{
+    ASSERT_STACK_OK_OR_RETURN(stack, stackFailureStatus(stack));
+
+    if (STACK_UNLIKELY(stack->size == stack->capacity) && !STACK_COMPRESS_COLD(stack) && !STACK_SPILL_COLD(stack))
+    {
+        elem_t* newDynamicArray = resizeArray(stack, stack->capacity * STACK_EXPAND_MULTIPLIER);
+
+        if (newDynamicArray == NULL)
+        {
+            return STACK_REALLOCATION_FAILED;
+        }
+    }
+
+    STACK_WRITE_BEGIN(stack);
+
+    stack->dynamicArray[stack->size] = value;
+    stack->size++;
+
+    #ifdef STACK_AGGREGATES_ENABLED
+    if (stack->aggregates.size == stack->size - 1 && stack->aggregates.capacity >= stack->size && 
+        stack->frozenSize == 0)
+    {
+        stackAggregatesAppend(stack);
+    }
+    #endif
+
+    STACK_UPDATE_HASH(stack);
+    STACK_WRITE_END(stack);
+    ASSERT_STACK_OK_OR_RETURN(stack, stackFailureStatus(stack));
+
+    return STACK_NO_ERROR;
+}
+
+//-----------------------------------------------------------------------------
+//! Removes the element on top of the stack and returns it. Undefined behavior
+//! if the stack is empty, unless STACK_NON_FATAL_ERRORS is defined, in which 
+//! case elem_t() is returned.
+//!
+//! @param [out]  stack    
+//!
+//! @note if pop is called from an empty stack then sets the stack's 
+//!       errorStatus to POP_FROM_EMPTY.
+//!
+//! @return the element on top of the stack.
+//-----------------------------------------------------------------------------
+elem_t fstackPop(Stack* stack)
+{
+    ASSERT_STACK_OK_OR_RETURN(stack, elem_t());
+
+    #ifdef STACK_SPILL_ENABLED
+    if (stack->spillReadahead > 0 && stack->size <= stack->spillReadahead)
+    {
+        stackSpillReadahead(stack);
+    }
+    #endif
+
+    #ifdef STACK_PACKED_SEGMENTS
+    if (!stackThawPackedTop(stack))
+    {
+        ASSERT_STACK_OK_OR_RETURN(stack, elem_t());
+        return elem_t();
+    }
+    #endif
+ 
+    if (STACK_UNLIKELY(stack->size == 0 && stack->frozenSize > 0))
+    {
+        STACK_WRITE_BEGIN(stack);
+
+        elem_t returnValue = stackFrozenTop(stack);
+        stackFrozenPop(stack);
+        stackDropStaleMarks(stack);
+
+        STACK_WRITE_END(stack);
+        ASSERT_STACK_OK_OR_RETURN(stack, elem_t());
+
+        return returnValue;
+    }
+
+    if (STACK_UNLIKELY(stack->size == 0))
+    {
+        stack->errorStatus = STACK_POP_FROM_EMPTY;
+        ASSERT_STACK_OK_OR_RETURN(stack, elem_t());
+    }
+
+    STACK_WRITE_BEGIN(stack);
+
+    stack->size--;
+    elem_t returnValue = stack->dynamicArray[stack->size];
+
+    STACK_AGGREGATES_TRIM(stack, stack->size);
+    PUT_POISON(stack->dynamicArray + stack->size, stack->dynamicArray + stack->size + 1);
+    STACK_UPDATE_HASH(stack);
+    stackDropStaleMarks(stack);
+    STACK_WRITE_END(stack);
+    ASSERT_STACK_OK_OR_RETURN(stack, elem_t());
+
+    return returnValue;
+}
+
+//-----------------------------------------------------------------------------
+//! Returns the element on top of the stack. Undefined behavior if the stack 
+//! is empty, unless STACK_NON_FATAL_ERRORS is defined, in which case elem_t()
+//! is returned.
+//!
+//! @param [out]  stack    
+//!
+//! @note if top is called from an empty stack then sets the stack's 
+//!       errorStatus to TOP_FROM_EMPTY.
+//!
+//! @return the element on top of the stack.
+//-----------------------------------------------------------------------------
+elem_t fstackTop(Stack* stack)
+{
+    ASSERT_STACK_OK_OR_RETURN(stack, elem_t());
+
+    #ifdef STACK_PACKED_SEGMENTS
+    if (!stackThawPackedTop(stack))
+    {
+        ASSERT_STACK_OK_OR_RETURN(stack, elem_t());
+        return elem_t();
+    }
+    #endif
+
+    if (STACK_UNLIKELY(stack->size == 0 && stack->frozenSize > 0))
+    {
+        return stackFrozenTop(stack);
+    }
+
+    if (STACK_UNLIKELY(stack->size == 0))
+    {
+        stack->errorStatus = STACK_TOP_FROM_EMPTY;
+        ASSERT_STACK_OK_OR_RETURN(stack, elem_t());
+    }
+
+    return stack->dynamicArray[stack->size - 1];
+}
+
+//-----------------------------------------------------------------------------
+//! Exchanges buffers and frozen elements of two stacks, leaving their marks 
+//! as they are.
+//!
+//! @param [out]  first   
+//! @param [out]  second   
+//-----------------------------------------------------------------------------
+void stackExchange(Stack* first, Stack* second)
+{
+    STACK_SCRUBBER_QUIESCE(first, second);
+    STACK_WRITE_BEGIN(first);
+    STACK_WRITE_BEGIN(second);
+
+    // Aggregates stay with their stacks, so they are rebuilt on next query
+    STACK_AGGREGATES_TRIM(first, 0);
+    STACK_AGGREGATES_TRIM(second, 0);
+
+    size_t        size         = first->size;
+    size_t        capacity     = first->capacity;
+    elem_t*       dynamicArray = first->dynamicArray;
+    StackSegment* frozen       = first->frozen;
+    size_t        frozenSize   = first->frozenSize;
+
+    first->size          = second->size;
+    first->capacity      = second->capacity;
+    first->dynamicArray  = second->dynamicArray;
+    first->frozen        = second->frozen;
+    first->frozenSize    = second->frozenSize;
+
+    second->size         = size;
+    second->capacity     = capacity;
+    second->dynamicArray = dynamicArray;
+    second->frozen       = frozen;
+    second->frozenSize   = frozenSize;
+
+    // Hashes are stored in the buffers and depend only on buffers' size and
+    // capacity, so they are swapped as well and needn't be recomputed, unless
+    // one of the buffers comes from a stack whose hash the scrubber keeps
+    #ifdef STACK_SCRUBBER_ENABLED
+    if (first->scrubbed != second->scrubbed)
+    {
+        STACK_UPDATE_HASH(first);
+        STACK_UPDATE_HASH(second);
+    }
+    #endif
+
+    STACK_WRITE_END(second);
+    STACK_WRITE_END(first);
+}
+
+//-----------------------------------------------------------------------------
+//! Exchanges contents of two stacks in O(1). Each stack keeps its name, 
+//! marks of both stacks are dropped, as they no longer match the contents.
+//!
+//! @param [out]  first   
+//! @param [out]  second   
+//-----------------------------------------------------------------------------
+void stackSwap(Stack* first, Stack* second)
+{
+    ASSERT_STACK_OK(first);
+    ASSERT_STACK_OK(second);
+
+    stackExchange(first, second);
+
+    first->marksCount  = 0;
+    second->marksCount = 0;
+
+    ASSERT_STACK_OK(first);
+    ASSERT_STACK_OK(second);
+}
+
+//-----------------------------------------------------------------------------
+//! Moves contents of source to destination in O(1) by stealing source's 
+//! buffer. Previous contents of destination are destroyed, source is left
+//! empty with capacity MINIMAL_STACK_CAPACITY. Marks of both stacks are 
+//! dropped.
+//!
+//! @param [out]  destination   
+//! @param [out]  source   
+//!
+//! @note if a new buffer for source can't be allocated then sets source's 
+//!       errorStatus to REALLOCATION_FAILED and leaves both stacks intact.
+//!
+//! @return NO_ERROR if moved successfully or some STACK_ERRORS code 
+//!         otherwise.
+//-----------------------------------------------------------------------------
+StackErrors stackMove(Stack* destination, Stack* source)
+{
+    ASSERT_STACK_OK_OR_RETURN(destination, stackFailureStatus(destination));
+    ASSERT_STACK_OK_OR_RETURN(source, stackFailureStatus(source));
+    assert(destination != source);
+
+    elem_t* emptyArray = allocateArray(source, MINIMAL_STACK_CAPACITY);
+    if (emptyArray == NULL)
+    {
+        source->errorStatus = STACK_REALLOCATION_FAILED;
+        ASSERT_STACK_OK_OR_RETURN(source, stackFailureStatus(source));
+        return STACK_REALLOCATION_FAILED;
+    }
+
+    elem_t* discardedArray = destination->dynamicArray;
+
+    STACK_SCRUBBER_QUIESCE(destination, source);
+    STACK_WRITE_BEGIN(destination);
+    STACK_WRITE_BEGIN(source);
+
+    PUT_POISON(discardedArray, discardedArray + destination->capacity);
+    stackReleaseFrozen(destination);
+
+    STACK_AGGREGATES_TRIM(destination, 0);
+    STACK_AGGREGATES_TRIM(source, 0);
+
+    destination->size         = source->size;
+    destination->capacity     = source->capacity;
+    destination->dynamicArray = source->dynamicArray;
+    destination->frozen       = source->frozen;
+    destination->frozenSize   = source->frozenSize;
+
+    source->size              = 0;
+    source->capacity          = MINIMAL_STACK_CAPACITY;
+    source->dynamicArray      = emptyArray;
+    source->frozen            = NULL;
+    source->frozenSize        = 0;
+
+    destination->marksCount   = 0;
+    source->marksCount        = 0;
+
+    #ifdef STACK_SCRUBBER_ENABLED
+    // The hash of a scrubbed source's buffer is kept by the scrubber
+    if (source->scrubbed)
+    {
+        STACK_UPDATE_HASH(destination);
+    }
+    #endif
+
+    STACK_UPDATE_HASH(source);
+
+    STACK_WRITE_END(source);
+    STACK_WRITE_END(destination);
+
+    freeArray(discardedArray);
+
+    ASSERT_STACK_OK_OR_RETURN(destination, stackFailureStatus(destination));
+    ASSERT_STACK_OK_OR_RETURN(source, stackFailureStatus(source));
+
+    return STACK_NO_ERROR;
+}
+
+//-----------------------------------------------------------------------------
+//! Copies all frozen elements of stack, from bottom to top, to destination 
+//! without thawing them, so that segments shared with forks stay shared.
+//!
+//! @param [in]   stack  
+//! @param [out]  destination  must have room for stack's frozenSize elements
+//!
+//! @return whether or not the elements were copied, which can only fail for
+//!         spilled segments.
+//-----------------------------------------------------------------------------
+bool stackFrozenCopy(const Stack* stack, elem_t* destination)
+{
+    size_t top = stack->frozenSize;
+
+    for (const StackSegment* segment = stack->frozen; segment != NULL; segment = segment->parent)
+    {
+        if (!stackSegmentCopy(segment, 0, top - segment->parentSize, destination + segment->parentSize))
+        {
+            return false;
+        }
+
+        top = segment->parentSize;
+    }
+
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+//! Appends all elements of source on top of destination and leaves source 
+//! empty. An empty destination takes source's buffer and frozen elements in
+//! O(1). Otherwise, if source has no frozen elements and its buffer is large 
+//! enough to hold both stacks and larger than destination's one, it is reused
+//! and buffers are exchanged, else destination's buffer is expanded if needed
+//! and source's elements are copied there, frozen ones straight from their 
+//! segments. Marks of source are dropped.
+//!
+//! @param [out]  destination   
+//! @param [out]  source   
+//!
+//! @note if realloc returned NULL then sets destination's errorStatus to 
+//!       REALLOCATION_FAILED, if a spilled segment of source couldn't be read
+//!       back intact then sets source's errorStatus to SPILL_FAILED. Both 
+//!       stacks are left intact then.
+//!
+//! @return NO_ERROR if spliced successfully or some STACK_ERRORS code 
+//!         otherwise.
+//-----------------------------------------------------------------------------
+StackErrors stackSplice(Stack* destination, Stack* source)
+{
+    ASSERT_STACK_OK_OR_RETURN(destination, stackFailureStatus(destination));
+    ASSERT_STACK_OK_OR_RETURN(source, stackFailureStatus(source));
+    assert(destination != source);
+
+    // Marks of an empty destination are all at its bottom, so they stay valid
+    if (destination->frozenSize == 0 && destination->size == 0)
+    {
+        stackExchange(destination, source);
+        source->marksCount = 0;
+
+        ASSERT_STACK_OK_OR_RETURN(destination, stackFailureStatus(destination));
+        ASSERT_STACK_OK_OR_RETURN(source, stackFailureStatus(source));
+
+        return STACK_NO_ERROR;
+    }
+
+    size_t newSize = destination->size + source->frozenSize + source->size;
+
+    // Aggregates of destination's elements stay valid, source is left empty
+    STACK_AGGREGATES_TRIM(source, 0);
+
+    if (source->frozenSize == 0 && source->capacity >= newSize && source->capacity > destination->capacity)
+    {
+        STACK_SCRUBBER_QUIESCE(destination, source);
+        STACK_WRITE_BEGIN(destination);
+        STACK_WRITE_BEGIN(source);
+
+        elem_t* sourceArray    = source->dynamicArray;
+        size_t  sourceCapacity = source->capacity;
+
+        memmove(sourceArray + destination->size, sourceArray, source->size * sizeof(elem_t));
+        memcpy (sourceArray, destination->dynamicArray, destination->size * sizeof(elem_t));
+
+        source->dynamicArray      = destination->dynamicArray;
+        source->capacity          = destination->capacity;
+        source->size              = 0;
+
+        destination->dynamicArray = sourceArray;
+        destination->capacity     = sourceCapacity;
+        destination->size         = newSize;
+
+        PUT_POISON(source->dynamicArray, source->dynamicArray + source->capacity);
+    }
+    else
+    {
+        if (destination->capacity < newSize)
+        {
+            size_t newCapacity = destination->capacity * STACK_EXPAND_MULTIPLIER;
+
+            if (resizeArray(destination, newCapacity > newSize ? newCapacity : newSize) == NULL)
+            {
+                return stackFailureStatus(destination);
+            }
+        }
+
+        STACK_WRITE_BEGIN(destination);
+        STACK_WRITE_BEGIN(source);
+
+        elem_t* appended = destination->dynamicArray + destination->size;
+
+        if (!stackFrozenCopy(source, appended))
+        {
+            PUT_POISON(appended, destination->dynamicArray + newSize);
+            source->errorStatus = STACK_SPILL_FAILED;
+
+            STACK_WRITE_END(source);
+            STACK_WRITE_END(destination);
+
+            ASSERT_STACK_OK_OR_RETURN(source, stackFailureStatus(source));
+            return stackFailureStatus(source);
+        }
+
+        memcpy(appended + source->frozenSize, source->dynamicArray, source->size * sizeof(elem_t));
+        PUT_POISON(source->dynamicArray, source->dynamicArray + source->size);
+        stackReleaseFrozen(source);
+
+        destination->size = newSize;
+        source->size      = 0;
+    }
+
+    source->marksCount = 0;
+
+    STACK_UPDATE_HASH(destination);
+    STACK_UPDATE_HASH(source);
+
+    STACK_WRITE_END(source);
+    STACK_WRITE_END(destination);
+
+    ASSERT_STACK_OK_OR_RETURN(destination, stackFailureStatus(destination));
+    ASSERT_STACK_OK_OR_RETURN(source, stackFailureStatus(source));
+
+    return STACK_NO_ERROR;
+}
+
+//-----------------------------------------------------------------------------
+//! Makes destination a copy-on-write fork of source. Source's elements are 
+//! frozen into an immutable segment shared by both stacks, so forking costs 
+//! O(1) regardless of stack's size. Popping shared elements just stops 
+//! referencing them, pushing writes to stack's own buffer.
+//!
+//! @param [out]  destination  its previous contents and marks are dropped
+//! @param [out]  source       its marks stay valid
+//!
+//! @note frozen segments' reference counts aren't atomic, so forks of one 
+//!       stack must be used from one thread.
+//! @note if calloc returned NULL then sets source's errorStatus to 
+//!       REALLOCATION_FAILED.
+//!
+//! @return NO_ERROR if forked successfully or some STACK_ERRORS code 
+//!         otherwise.
+//-----------------------------------------------------------------------------
+StackErrors stackFork(Stack* destination, Stack* source)
+{
+    ASSERT_STACK_OK_OR_RETURN(destination, stackFailureStatus(destination));
+    ASSERT_STACK_OK_OR_RETURN(source, stackFailureStatus(source));
+    assert(destination != source);
+
+    if (!stackFreeze(source))
+    {
+        ASSERT_STACK_OK_OR_RETURN(source, stackFailureStatus(source));
+        return STACK_REALLOCATION_FAILED;
+    }
+
+    STACK_WRITE_BEGIN(destination);
+
+    PUT_POISON(destination->dynamicArray, destination->dynamicArray + destination->size);
+    STACK_AGGREGATES_TRIM(destination, 0);
+    stackReleaseFrozen(destination);
+
+    destination->size       = 0;
+    destination->marksCount = 0;
+    destination->frozen     = source->frozen;
+    destination->frozenSize = source->frozenSize;
+
+    if (destination->frozen != NULL)
+    {
+        destination->frozen->refCount++;
+    }
+
+    STACK_UPDATE_HASH(destination);
+    STACK_WRITE_END(destination);
+
+    ASSERT_STACK_OK_OR_RETURN(destination, stackFailureStatus(destination));
+    ASSERT_STACK_OK_OR_RETURN(source, stackFailureStatus(source));
+
+    return STACK_NO_ERROR;
+}
+
+//-----------------------------------------------------------------------------
+//! Remembers stack's current size, so that the stack can later be unwound 
+//! to it by stackRollback() in one operation. Marks stay valid until the 
+//! stack is unwound below their depth (by pop, rollback to an earlier mark,
+//! clear, etc.) or its contents are replaced, which drops all its marks 
+//! (stackSwap(), stackMove(), stackFork() into it, stackSplice() from it).
+//!
+//! @param [out]  stack    
+//!
+//! @note if realloc returned NULL then sets stack's errorStatus to 
+//!       REALLOCATION_FAILED.
+//!
+//! @return mark of the current stack's size.
+//-----------------------------------------------------------------------------
+StackMark stackMark(Stack* stack)
+{
+    ASSERT_STACK_OK_OR_RETURN(stack, {});
+
+    StackMark mark = {};
+
+    if (stack->marksCount == stack->marksCapacity)
+    {
+        size_t     newCapacity = stack->marksCapacity > 0 ? stack->marksCapacity * STACK_EXPAND_MULTIPLIER 
+                                                          : MINIMAL_STACK_CAPACITY;
+        StackMark* newMarks    = (StackMark*) realloc(stack->marks, newCapacity * sizeof(StackMark));
+
+        if (newMarks == NULL)
+        {
+            stack->errorStatus = STACK_REALLOCATION_FAILED;
+            ASSERT_STACK_OK_OR_RETURN(stack, {});
+            return mark;
+        }
+
+        stack->marks         = newMarks;
+        stack->marksCapacity = newCapacity;
+    }
+
+    mark.stack  = stack;
+    mark.depth  = stack->frozenSize + stack->size;
+    mark.index  = stack->marksCount;
+    mark.serial = ++stack->marksSerial;
+
+    stack->marks[stack->marksCount++] = mark;
+
+    ASSERT_STACK_OK_OR_RETURN(stack, {});
+
+    return mark;
+}
+
+//-----------------------------------------------------------------------------
+//! Unwinds stack to the size it had when mark was made, in one operation: 
+//! the vacated range is poisoned and the hash is updated once. Marks made 
+//! after mark at the same depth stay valid, deeper ones are dropped.
+//!
+//! @param [out]  stack    
+//! @param [in]   mark    
+//!
+//! @note if mark wasn't made by this stack or the stack has since been 
+//!       unwound below it then sets stack's errorStatus to INVALID_MARK.
+//!
+//! @return NO_ERROR if rolled back successfully or some STACK_ERRORS code 
+//!         otherwise.
+//-----------------------------------------------------------------------------
+StackErrors stackRollback(Stack* stack, StackMark mark)
+{
+    ASSERT_STACK_OK_OR_RETURN(stack, stackFailureStatus(stack));
+
+    if (mark.stack  != stack                             ||
+        mark.index  >= stack->marksCount                 || 
+        mark.serial != stack->marks[mark.index].serial   ||
+        mark.depth  != stack->marks[mark.index].depth)
+    {
+        stack->errorStatus = STACK_INVALID_MARK;
+        ASSERT_STACK_OK_OR_RETURN(stack, stackFailureStatus(stack));
+        return STACK_INVALID_MARK;
+    }
+
+    STACK_WRITE_BEGIN(stack);
+
+    if (mark.depth >= stack->frozenSize)
+    {
+        size_t newSize = mark.depth - stack->frozenSize;
+
+        PUT_POISON(stack->dynamicArray + newSize, stack->dynamicArray + stack->size);
+        STACK_AGGREGATES_TRIM(stack, newSize);
+        stack->size = newSize;
+    }
+    else
+    {
+        PUT_POISON(stack->dynamicArray, stack->dynamicArray + stack->size);
+        STACK_AGGREGATES_TRIM(stack, 0);
+        stack->size = 0;
+
+        stackFrozenTruncate(stack, mark.depth);
+    }
+
+    STACK_UPDATE_HASH(stack);
+    stackDropStaleMarks(stack);
+    STACK_WRITE_END(stack);
+
+    ASSERT_STACK_OK_OR_RETURN(stack, stackFailureStatus(stack));
+
+    return STACK_NO_ERROR;
+}
+
+// Operands of short sequences are copied to the stack instead of the heap
+static const size_t STACK_EVALUATE_LOCAL_OPERANDS = 16;
+
+//-----------------------------------------------------------------------------
+//! @param [in]  operation  
+//!
+//! @return whether or not operation takes two operands.
+//-----------------------------------------------------------------------------
+bool isBinaryOperation(StackOperation operation)
+{
+    return operation <= STACK_OP_MAX;
+}
+
+//-----------------------------------------------------------------------------
+//! @param [in]  operation  
+//! @param [in]  second     element below the top
+//! @param [in]  top  
+//!
+//! @return result of binary operation.
+//-----------------------------------------------------------------------------
+elem_t applyBinaryOperation(StackOperation operation, elem_t second, elem_t top)
+{
+    switch (operation)
+    {
+        case STACK_OP_ADD: return second + top;
+        case STACK_OP_SUB: return second - top;
+        case STACK_OP_MUL: return second * top;
+        case STACK_OP_DIV: return second / top;
+        case STACK_OP_MIN: return second < top ? second : top;
+        case STACK_OP_MAX: return second > top ? second : top;
+
+        default: 
+            assert(! "Unknown binary operation");
+            return top;
+    }
+}
+
+//-----------------------------------------------------------------------------
+//! @param [in]  operation  
+//! @param [in]  top  
+//!
+//! @return result of unary operation.
+//-----------------------------------------------------------------------------
+elem_t applyUnaryOperation(StackOperation operation, elem_t top)
+{
+    switch (operation)
+    {
+        case STACK_OP_NEG:  return -top;
+        case STACK_OP_ABS:  return fabs(top);
+        case STACK_OP_SQRT: return sqrt(top);
+
+        default: 
+            assert(! "Unknown unary operation");
+            return top;
+    }
+}
+
+//-----------------------------------------------------------------------------
+//! Runs a sequence of operations against the top of the stack in place. The
+//! stack is validated once before and once after the whole sequence and its
+//! hash is updated once. Operations are checked to have enough operands 
+//! before any of them is run and are run on a copy of the operands, so on 
+//! error the stack is left unchanged.
+//!
+//! @param [out]  stack    
+//! @param [in]   operations    
+//! @param [in]   count    
+//!
+//! @note if the stack has not enough elements for the sequence then sets 
+//!       stack's errorStatus to NOT_ENOUGH_OPERANDS.
+//! @note if some operation's result is NaN (e.g. 0 / 0 or sqrt of a negative
+//!       number) then sets stack's errorStatus to DOMAIN_ERROR.
+//! @note if realloc returned NULL then sets stack's errorStatus to 
+//!       REALLOCATION_FAILED.
+//!
+//! @return NO_ERROR if evaluated successfully or some STACK_ERRORS code 
+//!         otherwise.
+//-----------------------------------------------------------------------------
+StackErrors stackEvaluate(Stack* stack, const StackOperation* operations, size_t count)
+{
+    ASSERT_STACK_OK_OR_RETURN(stack, stackFailureStatus(stack));
+    assert(operations != NULL || count == 0);
+
+    // Number of stack's current elements the sequence reaches down to
+    size_t requiredSize = 0;
+    size_t consumed     = 0;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        size_t operandsCount = isBinaryOperation(operations[i]) ? 2 : 1;
+
+        if (consumed + operandsCount > requiredSize)
+        {
+            requiredSize = consumed + operandsCount;
+        }
+
+        consumed += operandsCount - 1;
+    }
+
+    if (requiredSize > stack->frozenSize + stack->size)
+    {
+        stack->errorStatus = STACK_NOT_ENOUGH_OPERANDS;
+        ASSERT_STACK_OK_OR_RETURN(stack, stackFailureStatus(stack));
+        return STACK_NOT_ENOUGH_OPERANDS;
+    }
+
+    if (requiredSize > stack->size && !stackThaw(stack, requiredSize - stack->size))
+    {
+        ASSERT_STACK_OK_OR_RETURN(stack, stackFailureStatus(stack));
+        return stackFailureStatus(stack);
+    }
+
+    elem_t  localOperands[STACK_EVALUATE_LOCAL_OPERANDS];
+    elem_t* operands = localOperands;
+
+    if (requiredSize > STACK_EVALUATE_LOCAL_OPERANDS)
+    {
+        operands = (elem_t*) calloc(requiredSize, sizeof(elem_t));
+
+        if (operands == NULL)
+        {
+            stack->errorStatus = STACK_REALLOCATION_FAILED;
+            ASSERT_STACK_OK_OR_RETURN(stack, stackFailureStatus(stack));
+            return STACK_REALLOCATION_FAILED;
+        }
+    }
+
+    elem_t* base = stack->dynamicArray + stack->size - requiredSize;
+    memcpy(operands, base, requiredSize * sizeof(elem_t));
+
+    size_t size        = requiredSize;
+    bool   domainError = false;
+
+    for (size_t i = 0; i < count && !domainError; i++)
+    {
+        elem_t result = 0;
+
+        if (isBinaryOperation(operations[i]))
+        {
+            result = applyBinaryOperation(operations[i], operands[size - 2], operands[size - 1]);
+            size--;
+        }
+        else
+        {
+            result = applyUnaryOperation(operations[i], operands[size - 1]);
+        }
+
+        // NaN is poison, so it must never get into the stack
+        domainError = isnan(result);
+        operands[size - 1] = result;
+    }
+
+    if (domainError)
+    {
+        if (operands != localOperands)
+        {
+            free(operands);
+        }
+
+        stack->errorStatus = STACK_DOMAIN_ERROR;
+        ASSERT_STACK_OK_OR_RETURN(stack, stackFailureStatus(stack));
+        return STACK_DOMAIN_ERROR;
+    }
+
+    STACK_WRITE_BEGIN(stack);
+    STACK_AGGREGATES_TRIM(stack, stack->size - requiredSize);
+
+    memcpy(base, operands, size * sizeof(elem_t));
+    PUT_POISON(base + size, base + requiredSize);
+    stack->size -= requiredSize - size;
+
+    STACK_UPDATE_HASH(stack);
+    stackDropStaleMarks(stack);
+    STACK_WRITE_END(stack);
+
+    if (operands != localOperands)
+    {
+        free(operands);
+    }
+
+    ASSERT_STACK_OK_OR_RETURN(stack, stackFailureStatus(stack));
+
+    return STACK_NO_ERROR;
+}
+
+//-----------------------------------------------------------------------------
+//! Replaces two top elements (second, top) with (second OP top) in place, 
+//! which costs one validation and one hash update instead of pop, pop, push.
+//!
+//! @param [out]  stack    
+//! @param [in]   operation   one of binary STACK_OP_* operations
+//!
+//! @note if the stack has less than two elements then sets stack's 
+//!       errorStatus to NOT_ENOUGH_OPERANDS.
+//! @note if the result is NaN then sets stack's errorStatus to DOMAIN_ERROR.
+//!
+//! @return NO_ERROR if applied successfully or some STACK_ERRORS code 
+//!         otherwise.
+//-----------------------------------------------------------------------------
+StackErrors stackApplyBinary(Stack* stack, StackOperation operation)
+{
+    assert(isBinaryOperation(operation));
+
+    return stackEvaluate(stack, &operation, 1);
+}
+
+//-----------------------------------------------------------------------------
+//! Replaces top element with OP(top) in place.
+//!
+//! @param [out]  stack    
+//! @param [in]   operation   one of unary STACK_OP_* operations
+//!
+//! @note if the stack is empty then sets stack's errorStatus to 
+//!       NOT_ENOUGH_OPERANDS.
+//! @note if the result is NaN then sets stack's errorStatus to DOMAIN_ERROR.
+//!
+//! @return NO_ERROR if applied successfully or some STACK_ERRORS code 
+//!         otherwise.
+//-----------------------------------------------------------------------------
+StackErrors stackApplyUnary(Stack* stack, StackOperation operation)
+{
+    assert(!isBinaryOperation(operation));
+
+    return stackEvaluate(stack, &operation, 1);
+}
+
+//-----------------------------------------------------------------------------
+//! Whole-array kernels used by stackReduce() and stackTransform(). They are
+//! chosen once at runtime depending on CPU's support of vector instructions.
+//-----------------------------------------------------------------------------
+struct StackKernels
+{
+    elem_t (*sum)       (const elem_t* array, size_t count);
+    void   (*minMax)    (const elem_t* array, size_t count, elem_t* min, elem_t* max);
+    size_t (*nanCount)  (const elem_t* array, size_t count);
+    void   (*transform) (elem_t* array, size_t count, elem_t scale, elem_t offset);
+};
+
+elem_t scalarSum(const elem_t* array, size_t count)
+{
+    elem_t sum = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        sum += array[i];
+    }
+
+    return sum;
+}
+
+//-----------------------------------------------------------------------------
+//! Updates min and max with elements of array, NaNs are ignored.
+//-----------------------------------------------------------------------------
+void scalarMinMax(const elem_t* array, size_t count, elem_t* min, elem_t* max)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        if (array[i] < *min) { *min = array[i]; }
+        if (array[i] > *max) { *max = array[i]; }
+    }
+}
+
+size_t scalarNanCount(const elem_t* array, size_t count)
+{
+    size_t nanCount = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        nanCount += isnan(array[i]) ? 1 : 0;
+    }
+
+    return nanCount;
+}
+
+void scalarTransform(elem_t* array, size_t count, elem_t scale, elem_t offset)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        array[i] = scale * array[i] + offset;
+    }
+}
+
+#ifdef STACK_X86_KERNELS
+// Arrays are only 4-byte aligned when canaries are enabled, so all loads and
+// stores are unaligned.
+
+// Sums 8 interleaved partial sums, so the additions are reassociated and the 
+// result may differ from scalarSum()'s in the last bits.
+__attribute__((target("avx")))
+elem_t avxSum(const elem_t* array, size_t count)
+{
+    __m256d sum0 = _mm256_setzero_pd();
+    __m256d sum1 = _mm256_setzero_pd();
+
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        sum0 = _mm256_add_pd(sum0, _mm256_loadu_pd(array + i));
+        sum1 = _mm256_add_pd(sum1, _mm256_loadu_pd(array + i + 4));
+    }
+
+    elem_t lanes[4];
+    _mm256_storeu_pd(lanes, _mm256_add_pd(sum0, sum1));
+
+    return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]) + scalarSum(array + i, count - i);
+}
+
+__attribute__((target("avx")))
+void avxMinMax(const elem_t* array, size_t count, elem_t* min, elem_t* max)
+{
+    // min/max_pd return the second operand if either is NaN, so keeping 
+    // accumulators second ignores NaNs the same way scalarMinMax() does
+    __m256d minAccumulator = _mm256_set1_pd(*min);
+    __m256d maxAccumulator = _mm256_set1_pd(*max);
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        __m256d values = _mm256_loadu_pd(array + i);
+
+        minAccumulator = _mm256_min_pd(values, minAccumulator);
+        maxAccumulator = _mm256_max_pd(values, maxAccumulator);
+    }
+
+    elem_t minLanes[4];
+    elem_t maxLanes[4];
+    _mm256_storeu_pd(minLanes, minAccumulator);
+    _mm256_storeu_pd(maxLanes, maxAccumulator);
+
+    for (size_t lane = 0; lane < 4; lane++)
+    {
+        if (minLanes[lane] < *min) { *min = minLanes[lane]; }
+        if (maxLanes[lane] > *max) { *max = maxLanes[lane]; }
+    }
+
+    scalarMinMax(array + i, count - i, min, max);
+}
+
+__attribute__((target("avx")))
+size_t avxNanCount(const elem_t* array, size_t count)
+{
+    size_t nanCount = 0;
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        __m256d values = _mm256_loadu_pd(array + i);
+        nanCount += __builtin_popcount(_mm256_movemask_pd(_mm256_cmp_pd(values, values, _CMP_UNORD_Q)));
+    }
+
+    return nanCount + scalarNanCount(array + i, count - i);
+}
+
+__attribute__((target("avx")))
+void avxTransform(elem_t* array, size_t count, elem_t scale, elem_t offset)
+{
+    // No FMA, so that results are bitwise equal to scalarTransform()'s
+    __m256d scales  = _mm256_set1_pd(scale);
+    __m256d offsets = _mm256_set1_pd(offset);
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        __m256d values = _mm256_loadu_pd(array + i);
+        _mm256_storeu_pd(array + i, _mm256_add_pd(_mm256_mul_pd(values, scales), offsets));
+    }
+
+    scalarTransform(array + i, count - i, scale, offset);
+}
+#endif
+
+//-----------------------------------------------------------------------------
+//! @return the fastest kernels supported by the CPU.
+//-----------------------------------------------------------------------------
+const StackKernels* stackKernels()
+{
+    static const StackKernels scalarKernels = { scalarSum, scalarMinMax, scalarNanCount, scalarTransform };
+
+    #ifdef STACK_X86_KERNELS
+    static const StackKernels avxKernels    = { avxSum,    avxMinMax,    avxNanCount,    avxTransform    };
+    static const bool         avxSupported  = __builtin_cpu_supports("avx");
+
+    if (avxSupported)
+    {
+        return &avxKernels;
+    }
+    #endif
+
+    return &scalarKernels;
+}
+
+struct StackReduceState
+{
+    elem_t sum      = 0;
+    elem_t min      = INFINITY;
+    elem_t max      = -INFINITY;
+    size_t nanCount = 0;
+};
+
+//-----------------------------------------------------------------------------
+//! Adds count elements of array to the reduction's state.
+//!
+//! @param [out]  state    
+//! @param [in]   kernels    
+//! @param [in]   reduction    
+//! @param [in]   array    
+//! @param [in]   count    
+//-----------------------------------------------------------------------------
+void reduceArray(StackReduceState* state, const StackKernels* kernels, StackReduction reduction, 
+                 const elem_t* array, size_t count)
+{
+    switch (reduction)
+    {
+        case STACK_REDUCE_SUM:
+        case STACK_REDUCE_MEAN:
+            state->sum += kernels->sum(array, count);
+        break;
+
+        case STACK_REDUCE_MIN:
+        case STACK_REDUCE_MAX:
+            kernels->minMax(array, count, &state->min, &state->max);
+        break;
+
+        case STACK_REDUCE_NAN_COUNT:
+            state->nanCount += kernels->nanCount(array, count);
+        break;
+    }
+}
+
+//-----------------------------------------------------------------------------
+//! Reduces all elements of the stack in one pass over its memory. Frozen 
+//! elements are read in place, without copying, compressed and spilled ones
+//! are decoded or read in small chunks.
+//!
+//! @param [in]  stack    
+//! @param [in]  reduction    
+//!
+//! @note NaNs are ignored by MIN and MAX. MIN and MAX of a stack without 
+//!       (non-NaN) elements are +INFINITY and -INFINITY respectively, MEAN of
+//!       an empty stack is NaN.
+//! @note SUM and MEAN aren't bit-exact: the order of additions depends on 
+//!       segment boundaries and on the kernels the CPU supports.
+//!
+//! @return result of the reduction (NAN_COUNT is returned as elem_t too).
+//-----------------------------------------------------------------------------
+elem_t stackReduce(Stack* stack, StackReduction reduction)
+{
+    ASSERT_STACK_OK_OR_RETURN(stack, elem_t());
+
+    const StackKernels* kernels = stackKernels();
+    StackReduceState    state   = {};
+
+    reduceArray(&state, kernels, reduction, stack->dynamicArray, stack->size);
+
+    // Then the used part of each frozen segment
+    size_t limit = stack->frozenSize;
+
+    for (StackSegment* segment = stack->frozen; segment != NULL; segment = segment->parent)
+    {
+        size_t count = limit - segment->parentSize;
+        limit = segment->parentSize;
+
+        #ifdef STACK_COMPRESSION_ENABLED
+        if (segment->compressed != NULL)
+        {
+            StackXorDecoder decoder = {};
+            decoder.stream.data = segment->compressed;
+
+            elem_t chunk[STACK_XOR_DECODE_CHUNK];
+
+            while (decoder.decoded < count)
+            {
+                size_t chunkSize = count - decoder.decoded < STACK_XOR_DECODE_CHUNK ? count - decoder.decoded 
+                                                                                    : STACK_XOR_DECODE_CHUNK;
+
+                xorDecompress(&decoder, chunk, chunkSize);
+                reduceArray(&state, kernels, reduction, chunk, chunkSize);
+            }
+
+            continue;
+        }
+        #endif
+
+        #ifdef STACK_SPILL_ENABLED
+        if (segment->spillFile != NULL)
+        {
+            StackSpillReader reader = stackSpillReader(segment);
+            bool             read   = true;
+
+            elem_t chunk[STACK_SPILL_READ_CHUNK];
+
+            while (read && reader.position < count)
+            {
+                size_t chunkSize = count - reader.position < STACK_SPILL_READ_CHUNK ? count - reader.position 
+                                                                                     : STACK_SPILL_READ_CHUNK;
+
+                read = stackSpillReadNext(&reader, chunk, chunkSize);
+
+                if (read)
+                {
+                    reduceArray(&state, kernels, reduction, chunk, chunkSize);
+                }
+            }
+
+            if (!read || !stackSpillReadEnd(&reader))
+            {
+                stack->errorStatus = STACK_SPILL_FAILED;
+                ASSERT_STACK_OK_OR_RETURN(stack, elem_t());
+                return elem_t();
+            }
+
+            continue;
+        }
+        #endif
+
+        reduceArray(&state, kernels, reduction, segment->dynamicArray, count);
+    }
+
+    switch (reduction)
+    {
+        case STACK_REDUCE_SUM:       return state.sum;
+        case STACK_REDUCE_MIN:       return state.min;
+        case STACK_REDUCE_MAX:       return state.max;
+        case STACK_REDUCE_MEAN:      return state.sum / (elem_t) (stack->frozenSize + stack->size);
+        case STACK_REDUCE_NAN_COUNT: return (elem_t) state.nanCount;
+    }
+
+    assert(! "Unknown reduction");
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+//! @param [in]  array    
+//! @param [in]  count    
+//! @param [in]  scale    
+//! @param [in]  offset    
+//!
+//! @return whether or not scale * x + offset is NaN for some element x of 
+//!         array that isn't NaN itself.
+//-----------------------------------------------------------------------------
+bool transformMakesNan(const elem_t* array, size_t count, elem_t scale, elem_t offset)
+{
+    // Such a transform maps both numbers and infinities to numbers or infinities
+    if (isfinite(scale) && scale != 0 && isfinite(offset))
+    {
+        return false;
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        if (!isnan(array[i]) && isnan(scale * array[i] + offset))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+//-----------------------------------------------------------------------------
+//! Replaces every element x of the stack with scale * x + offset in one pass
+//! over its memory, updating the hash once afterwards. Frozen elements are 
+//! copied into stack's own buffer first.
+//!
+//! @param [out]  stack    
+//! @param [in]   scale    
+//! @param [in]   offset    
+//!
+//! @note if some element would become NaN (e.g. INFINITY * 0) then sets 
+//!       stack's errorStatus to DOMAIN_ERROR and leaves the stack unchanged.
+//! @note if realloc returned NULL then sets stack's errorStatus to 
+//!       REALLOCATION_FAILED.
+//!
+//! @return NO_ERROR if transformed successfully or some STACK_ERRORS code 
+//!         otherwise.
+//-----------------------------------------------------------------------------
+StackErrors stackTransform(Stack* stack, elem_t scale, elem_t offset)
+{
+    ASSERT_STACK_OK_OR_RETURN(stack, stackFailureStatus(stack));
+
+    if (!stackThaw(stack, stack->frozenSize))
+    {
+        ASSERT_STACK_OK_OR_RETURN(stack, stackFailureStatus(stack));
+        return stackFailureStatus(stack);
+    }
+
+    if (transformMakesNan(stack->dynamicArray, stack->size, scale, offset))
+    {
+        stack->errorStatus = STACK_DOMAIN_ERROR;
+        ASSERT_STACK_OK_OR_RETURN(stack, stackFailureStatus(stack));
+        return STACK_DOMAIN_ERROR;
+    }
+
+    STACK_WRITE_BEGIN(stack);
+    STACK_AGGREGATES_TRIM(stack, 0);
+
+    stackKernels()->transform(stack->dynamicArray, stack->size, scale, offset);
+
+    STACK_UPDATE_HASH(stack);
+    STACK_WRITE_END(stack);
+
+    ASSERT_STACK_OK_OR_RETURN(stack, stackFailureStatus(stack));
+
+    return STACK_NO_ERROR;
+}
+
+//-----------------------------------------------------------------------------
+//! Creates a read-only view of stack's elements. The stack is validated once
+//! here, after that elements can be read directly through view's data without
+//! copying: data[0] is the bottom of the stack and data[size - 1] is its top.
+//!
+//! @param [in]  stack    
+//!
+//! @note any modification of the stack invalidates the view. In debug mode 
+//!       this is detected by stackViewValid() and the stackView* accessors.
+//!
+//! @note stacks with frozen elements (shared with forks, compressed or 
+//!       spilled) aren't stored contiguously and can't be viewed, for them 
+//!       errorStatus is set to VIEW_OF_FROZEN.
+//!
+//! @return view of stack's elements or an invalid view if it can't be 
+//!         created.
+//-----------------------------------------------------------------------------
+StackView stackView(Stack* stack)
+{
+    ASSERT_STACK_OK_OR_RETURN(stack, {});
+
+    if (stack->frozenSize > 0)
+    {
+        stack->errorStatus = STACK_VIEW_OF_FROZEN;
+        ASSERT_STACK_OK_OR_RETURN(stack, {});
+        return {};
+    }
+
+    StackView view = {};
+    view.data = stack->dynamicArray;
+    view.size = stack->size;
+
+    #ifdef STACK_DEBUG_MODE
+    view.stack             = stack;
+    view.modificationCount = stack->modificationCount;
+    #endif
+
+    return view;
+}
+
+//-----------------------------------------------------------------------------
+//! @param [in]  view    
+//!
+//! @return whether or not view was created successfully and its stack is 
+//!         unmodified since then. Modifications are only detected in debug
+//!         mode.
+//-----------------------------------------------------------------------------
+bool stackViewValid(const StackView* view)
+{
+    assert(view != NULL);
+
+    if (view->data == NULL)
+    {
+        return false;
+    }
+
+    #ifdef STACK_DEBUG_MODE
+    return view->stack                    != NULL                     &&
+           view->stack->status            == STACK_STATUS_CONSTRUCTED && 
+           view->stack->modificationCount == view->modificationCount;
+    #else
+    return true;
+    #endif
+}
+
+//-----------------------------------------------------------------------------
+//! Sets view's stack errorStatus to MODIFIED_WHILE_VIEWED if the view is no
+//! longer valid.
+//!
+//! @param [in]  view    
+//!
+//! @return whether or not the view can be read.
+//-----------------------------------------------------------------------------
+bool stackViewAssertValid(const StackView* view)
+{
+    assert(view != NULL);
+
+    // Views that failed to be created have no stack to report to
+    if (view->data == NULL)
+    {
+        return false;
+    }
+
+    #ifdef STACK_DEBUG_MODE
+    if (STACK_UNLIKELY(!stackViewValid(view)))
+    {
+        if (view->stack->errorStatus == STACK_NO_ERROR && view->stack->status == STACK_STATUS_CONSTRUCTED)
+        {
+            view->stack->errorStatus = STACK_MODIFIED_WHILE_VIEWED;
+        }
+
+        ASSERT_STACK_OK_OR_RETURN(view->stack, false);
+    }
+    #endif
+
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+//! @param [in]  view    
+//!
+//! @return pointer to the bottom element of the view, iteration from bottom
+//!         to top goes from stackViewBegin() to stackViewEnd().
+//-----------------------------------------------------------------------------
+const elem_t* stackViewBegin(const StackView* view)
+{
+    if (!stackViewAssertValid(view))
+    {
+        return NULL;
+    }
+
+    return view->data;
+}
+
+//-----------------------------------------------------------------------------
+//! @param [in]  view    
+//!
+//! @return pointer past the top element of the view.
+//-----------------------------------------------------------------------------
+const elem_t* stackViewEnd(const StackView* view)
+{
+    if (!stackViewAssertValid(view))
+    {
+        return NULL;
+    }
+
+    return view->data + view->size;
+}
+
+//-----------------------------------------------------------------------------
+//! @param [in]  view    
+//!
+//! @return iterator to the top element of the view, iteration from top to 
+//!         bottom goes from stackViewRBegin() to stackViewREnd().
+//-----------------------------------------------------------------------------
+StackViewReverseIterator stackViewRBegin(const StackView* view)
+{
+    return StackViewReverseIterator(stackViewEnd(view));
+}
+
+//-----------------------------------------------------------------------------
+//! @param [in]  view    
+//!
+//! @return iterator past the bottom element of the view.
+//-----------------------------------------------------------------------------
+StackViewReverseIterator stackViewREnd(const StackView* view)
+{
+    return StackViewReverseIterator(stackViewBegin(view));
+}
+
+//-----------------------------------------------------------------------------
+//! @param [in]  view    
+//! @param [in]  index   index counted from the bottom of the stack
+//!
+//! @return element at index.
+//-----------------------------------------------------------------------------
+elem_t stackViewAt(const StackView* view, size_t index)
+{
+    if (!stackViewAssertValid(view))
+    {
+        return elem_t();
+    }
+
+    assert(index < view->size);
+
+    return view->data[index];
+}
+
+//-----------------------------------------------------------------------------
+//! @param [in]  view    
+//! @param [in]  index   index counted from the top of the stack (0 is top)
+//!
+//! @return element at index.
+//-----------------------------------------------------------------------------
+elem_t stackViewFromTop(const StackView* view, size_t index)
+{
+    if (!stackViewAssertValid(view))
+    {
+        return elem_t();
+    }
+
+    assert(index < view->size);
+
+    return view->data[view->size - 1 - index];
+}
+
+//-----------------------------------------------------------------------------
+//! Empties stack.
+//!
+//! @param [out]  stack    
+//-----------------------------------------------------------------------------
+void stackClear(Stack* stack)
+{
+    ASSERT_STACK_OK(stack);
+
+    STACK_WRITE_BEGIN(stack);
+
+    STACK_AGGREGATES_TRIM(stack, 0);
+
+    stack->size       = 0;
+    stack->marksCount = 0;
+    stackReleaseFrozen(stack);
+
+    PUT_POISON(stack->dynamicArray, stack->dynamicArray + stack->capacity);
+    STACK_UPDATE_HASH(stack);
+    STACK_WRITE_END(stack);
+
+    if (stack->capacity > MINIMAL_STACK_CAPACITY && !stackShrinkToFit(stack))
+    {
+        stack->errorStatus = STACK_REALLOCATION_FAILED;
+        ASSERT_STACK_OK(stack);
+    }
+
+    ASSERT_STACK_OK(stack);
+}
+
+//-----------------------------------------------------------------------------
+//! Resizes stack's array to max(stack's size, MINIMAL_STACK_CAPACITY). If 
+//! reallocation was unsuccessful, returns false, sets stack's errorStatus to 
+//! REALLOCATION_FAILED, but current elements of the stack won't be removed.
+//!
+//! @param [out]  stack   
+//!
+//! @return whether or not shrinking was successful.
+//-----------------------------------------------------------------------------
+bool stackShrinkToFit(Stack* stack)
+{
+    ASSERT_STACK_OK_OR_RETURN(stack, false);
+
+    if (stack->capacity <= MINIMAL_STACK_CAPACITY)
+    {
+        return false;
+    }
+
+    elem_t* newDynamicArray = resizeArray(stack, stack->size > MINIMAL_STACK_CAPACITY ? stack->size : MINIMAL_STACK_CAPACITY);
+    if (newDynamicArray == NULL)
+    {
+        stack->errorStatus = STACK_REALLOCATION_FAILED;
+        ASSERT_STACK_OK_OR_RETURN(stack, false);
+        return false;
+    }
+
+    STACK_WRITE_BEGIN(stack);
+    STACK_UPDATE_HASH(stack);
+    STACK_WRITE_END(stack);
+    ASSERT_STACK_OK_OR_RETURN(stack, false);
+
+    return true;
+}
+
+#ifdef STACK_HUGE_PAGES_ENABLED
+//-----------------------------------------------------------------------------
+//! Sets stack's memory policy and moves stack's buffer accordingly. Frozen
+//! segments keep their memory. On systems other than Linux the policy is
+//! accepted but ignored.
+//!
+//! @param [out]  stack   
+//! @param [in]   policy   
+//!
+//! @note if reallocation failed then sets stack's errorStatus to 
+//!       REALLOCATION_FAILED.
+//!
+//! @return NO_ERROR if the buffer was moved successfully or some STACK_ERRORS
+//!         code otherwise.
+//-----------------------------------------------------------------------------
+StackErrors stackSetMemoryPolicy(Stack* stack, const StackMemoryPolicy* policy)
+{
+    ASSERT_STACK_OK_OR_RETURN(stack, stackFailureStatus(stack));
+    assert(policy != NULL);
+
+    stack->memoryPolicy = *policy;
+
+    if (resizeArray(stack, stack->capacity) == NULL)
+    {
+        return STACK_REALLOCATION_FAILED;
+    }
+
+    ASSERT_STACK_OK_OR_RETURN(stack, stackFailureStatus(stack));
+
+    return STACK_NO_ERROR;
+}
+#endif
+
+#ifdef STACK_COMPRESSION_ENABLED
+//-----------------------------------------------------------------------------
+//! Turns on compression of stack's cold elements. Whenever stack's buffer is
+//! full and holds at least 2 * blockSize elements, its bottom elements are 
+//! compressed into frozen segments of blockSize elements instead of growing
+//! the buffer. A segment is decompressed when popping reaches it.
+//!
+//! @param [out]  stack   
+//! @param [in]   blockSize   0 turns compression off, otherwise it is 
+//!                           increased to MINIMAL_STACK_CAPACITY if smaller
+//!
+//! @return NO_ERROR or some STACK_ERRORS code if stack isn't ok.
+//-----------------------------------------------------------------------------
+StackErrors stackSetCompression(Stack* stack, size_t blockSize)
+{
+    ASSERT_STACK_OK_OR_RETURN(stack, stackFailureStatus(stack));
+
+    if (blockSize != 0 && blockSize < MINIMAL_STACK_CAPACITY)
+    {
+        blockSize = MINIMAL_STACK_CAPACITY;
+    }
+
+    stack->compressionBlock = blockSize;
+
+    return STACK_NO_ERROR;
+}
+#endif
+
+#ifdef STACK_SPILL_ENABLED
+//-----------------------------------------------------------------------------
+//! Limits stack's buffer to budget bytes. Once the buffer reaches the budget,
+//! the bottom half of its elements is written to a temporary file instead of
+//! growing the buffer, and read back (with readahead) when popping gets to 
+//! them. Each spilled chunk carries a checksum validated on reload.
+//!
+//! @param [out]  stack   
+//! @param [in]   budget   0 removes the limit
+//!
+//! @note with compression the budget also covers compressed blocks, which 
+//!       take at most half of it.
+//! @note if the temporary file can't be written, the buffer grows beyond the
+//!       budget instead. If a spilled chunk can't be read back intact, 
+//!       stack's errorStatus is set to SPILL_FAILED.
+//!
+//! @return NO_ERROR or some STACK_ERRORS code if stack isn't ok.
+//-----------------------------------------------------------------------------
+StackErrors stackSetMemoryBudget(Stack* stack, size_t budget)
+{
+    ASSERT_STACK_OK_OR_RETURN(stack, stackFailureStatus(stack));
+
+    stack->memoryBudget = budget;
+
+    return STACK_NO_ERROR;
+}
+#endif
+
+#ifdef STACK_AGGREGATES_ENABLED
+//-----------------------------------------------------------------------------
+//! Brings stack's aggregates up to date with all of its elements. Frozen 
+//! elements are thawed first, as aggregates are kept for dynamicArray only.
+//!
+//! @param [out]  stack   
+//!
+//! @note if realloc returned NULL then sets stack's errorStatus to 
+//!       REALLOCATION_FAILED, if a spilled segment couldn't be read back 
+//!       intact then sets it to SPILL_FAILED.
+//!
+//! @return whether or not aggregates cover all stack's elements.
+//-----------------------------------------------------------------------------
+bool stackAggregatesUpdate(Stack* stack)
+{
+    if (!stackThaw(stack, stack->frozenSize))
+    {
+        return false;
+    }
+
+    if (stack->aggregates.capacity < stack->size && !stackAggregatesResize(stack))
+    {
+        stack->errorStatus = STACK_REALLOCATION_FAILED;
+        return false;
+    }
+
+    while (stack->aggregates.size < stack->size)
+    {
+        stackAggregatesAppend(stack);
+    }
+
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+//! Turns on (or off) aggregates of stack's elements. While they are on, push
+//! and pop maintain prefix min, max and sum of the elements in parallel 
+//! tracks, so stackMin(), stackMax() and stackSum() take O(1). The tracks 
+//! have canaries and poison just like dynamicArray.
+//!
+//! @param [out]  stack   
+//! @param [in]   enabled   
+//!
+//! @note aggregated stacks keep all elements in their own buffer: frozen 
+//!       ones are thawed here, compression and spilling are suspended and
+//!       the elements a fork shares are copied back on the next query.
+//! @note if realloc returned NULL then sets stack's errorStatus to 
+//!       REALLOCATION_FAILED.
+//!
+//! @return NO_ERROR if aggregates were set successfully or some STACK_ERRORS
+//!         code otherwise.
+//-----------------------------------------------------------------------------
+StackErrors stackSetAggregates(Stack* stack, bool enabled)
+{
+    ASSERT_STACK_OK_OR_RETURN(stack, stackFailureStatus(stack));
+
+    if (!enabled)
+    {
+        stackAggregatesFree(stack);
+        return STACK_NO_ERROR;
+    }
+
+    if (!stackAggregatesResize(stack))
+    {
+        stack->errorStatus = STACK_REALLOCATION_FAILED;
+        ASSERT_STACK_OK_OR_RETURN(stack, stackFailureStatus(stack));
+        return STACK_REALLOCATION_FAILED;
+    }
+
+    if (!stackAggregatesUpdate(stack))
+    {
+        ASSERT_STACK_OK_OR_RETURN(stack, stackFailureStatus(stack));
+        return stack->errorStatus;
+    }
+
+    ASSERT_STACK_OK_OR_RETURN(stack, stackFailureStatus(stack));
+
+    return STACK_NO_ERROR;
+}
+
+//-----------------------------------------------------------------------------
+//! @param [out]  stack   
+//! @param [in]   track   MIN, MAX or SUM
+//!
+//! @return aggregate of all stack's elements, see stackMin(), stackMax() and 
+//!         stackSum().
+//-----------------------------------------------------------------------------
+elem_t stackAggregate(Stack* stack, StackAggregateTrack track)
+{
+    ASSERT_STACK_OK_OR_RETURN(stack, elem_t());
+
+    if (!stackAggregated(stack))
+    {
+        return stackReduce(stack, track == STACK_TRACK_MIN ? STACK_REDUCE_MIN : 
+                                  track == STACK_TRACK_MAX ? STACK_REDUCE_MAX : STACK_REDUCE_SUM);
+    }
+
+    if (!stackAggregatesUpdate(stack))
+    {
+        ASSERT_STACK_OK_OR_RETURN(stack, elem_t());
+        return elem_t();
+    }
+
+    size_t  size   = stack->size;
+    elem_t* tracks = stack->aggregates.tracks[track];
+
+    switch (track)
+    {
+        case STACK_TRACK_MIN: return size > 0 ? tracks[size - 1] : INFINITY;
+        case STACK_TRACK_MAX: return size > 0 ? tracks[size - 1] : -INFINITY;
+        case STACK_TRACK_SUM: return size > 0 ? tracks[size - 1] + 
+                                                stack->aggregates.tracks[STACK_TRACK_COMPENSATION][size - 1] : 0;
+        default:              break;
+    }
+
+    assert(! "Unknown aggregate");
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+//! @param [out]  stack   
+//!
+//! @note NaNs are ignored, minimum of a stack without (non-NaN) elements is
+//!       +INFINITY. Takes O(1) if stack's aggregates are on, otherwise it is
+//!       the same as stackReduce(stack, STACK_REDUCE_MIN).
+//!
+//! @return minimum of stack's elements.
+//-----------------------------------------------------------------------------
+elem_t stackMin(Stack* stack)
+{
+    return stackAggregate(stack, STACK_TRACK_MIN);
+}
+
+//-----------------------------------------------------------------------------
+//! @param [out]  stack   
+//!
+//! @note NaNs are ignored, maximum of a stack without (non-NaN) elements is
+//!       -INFINITY. Takes O(1) if stack's aggregates are on, otherwise it is
+//!       the same as stackReduce(stack, STACK_REDUCE_MAX).
+//!
+//! @return maximum of stack's elements.
+//-----------------------------------------------------------------------------
+elem_t stackMax(Stack* stack)
+{
+    return stackAggregate(stack, STACK_TRACK_MAX);
+}
+
+//-----------------------------------------------------------------------------
+//! @param [out]  stack   
+//!
+//! @note takes O(1) if stack's aggregates are on, in which case the sum is 
+//!       compensated (Kahan-Babuska) and so doesn't accumulate rounding 
+//!       errors of pushes and pops. Otherwise it is the same as 
+//!       stackReduce(stack, STACK_REDUCE_SUM).
+//!
+//! @return sum of stack's elements.
+//-----------------------------------------------------------------------------
+elem_t stackSum(Stack* stack)
+{
+    return stackAggregate(stack, STACK_TRACK_SUM);
+}
+
+//-----------------------------------------------------------------------------
+//! Checks stack's aggregate tracks: their size, canaries and poison.
+//!
+//! @param [in]  stack   
+//!
+//! @note the scrubber doesn't check aggregate tracks, so they are always 
+//!       scanned here, even for scrubbed stacks.
+//!
+//! @return whether or not stack's aggregate tracks are intact.
+//-----------------------------------------------------------------------------
+bool stackCheckAggregates(const Stack* stack)
+{
+    const StackAggregates* aggregates = &stack->aggregates;
+
+    if (!stackAggregated(stack))
+    {
+        return aggregates->size == 0 && aggregates->capacity == 0;
+    }
+
+    if (aggregates->size > stack->size || aggregates->size > aggregates->capacity ||
+       (aggregates->size > 0 && stack->frozenSize > 0))
+    {
+        return false;
+    }
+
+    for (size_t track = 0; track < STACK_TRACKS_COUNT; track++)
+    {
+        if (aggregates->tracks[track] == NULL)
+        {
+            return false;
+        }
+
+        #ifdef STACK_CANARIES_ENABLED
+        if (!arrayCheckCanaries(aggregates->tracks[track], aggregates->capacity))
+        {
+            return false;
+        }
+        #endif
+
+        #ifdef STACK_POISON
+        // Used entries may be NaN (e.g. sum of opposite infinities)
+        if (!arrayCheckPoison(aggregates->tracks[track] + aggregates->size, 0, 
+                              aggregates->capacity - aggregates->size))
+        {
+            return false;
+        }
+        #endif
+    }
+
+    return true;
+}
+#endif
+
+//-----------------------------------------------------------------------------
+//! Checks stack's frozen segments: their sizes, canaries, poison and hash.
+//!
+//! @param [in]  stack   
+//! @param [in]  scanSegments   whether or not to walk the whole chain and scan
+//!                             every segment, otherwise only the top segment's
+//!                             bounds are checked
+//!
+//! @note segments are immutable and hashed once when frozen, and forks can 
+//!       build long chains of them, so they are only scanned by full checks
+//!       (stackAuditAll), not on every operation.
+//!
+//! @return whether or not stack's frozen segments are intact.
+//-----------------------------------------------------------------------------
+bool stackCheckFrozen(const Stack* stack, bool scanSegments)
+{
+    if ((stack->frozen == NULL) != (stack->frozenSize == 0))
+    {
+        return false;
+    }
+
+    if (stack->frozen == NULL)
+    {
+        return true;
+    }
+
+    if (stack->frozenSize <= stack->frozen->parentSize || 
+        stack->frozenSize >  stack->frozen->parentSize + stack->frozen->size)
+    {
+        return false;
+    }
+
+    if (!scanSegments)
+    {
+        return stack->frozen->refCount != 0 && stack->frozen->size <= stack->frozen->capacity;
+    }
+
+    for (const StackSegment* segment = stack->frozen; segment != NULL; segment = segment->parent)
+    {
+        const StackSegment* parent = segment->parent;
+
+        if (segment->refCount == 0 || segment->size == 0 || segment->size > segment->capacity)
+        {
+            return false;
+        }
+
+        if ((parent == NULL) != (segment->parentSize == 0))
+        {
+            return false;
+        }
+
+        if (parent != NULL && (segment->parentSize <= parent->parentSize || 
+                               segment->parentSize >  parent->parentSize + parent->size))
+        {
+            return false;
+        }
+
+        #ifdef STACK_COMPRESSION_ENABLED
+        if (segment->compressed != NULL)
+        {
+            if (segment->dynamicArray != NULL || segment->compressedSize == 0)
+            {
+                return false;
+            }
+
+            #ifdef STACK_ARRAY_HASHING
+            if (computeHash(segment->compressed, segment->compressedSize, 
+                            stackHashBase(segment->size, segment->capacity)) != segment->compressedHash)
+            {
+                return false;
+            }
+            #endif
+
+            continue;
+        }
+        #endif
+
+        // Spilled segments are validated by their checksum when read back
+        #ifdef STACK_SPILL_ENABLED
+        if (segment->spillFile != NULL)
+        {
+            if (segment->dynamicArray != NULL)
+            {
+                return false;
+            }
+
+            continue;
+        }
+        #endif
+
+        if (segment->dynamicArray == NULL)
+        {
+            return false;
+        }
+
+        #ifdef STACK_CANARIES_ENABLED
+        if (!arrayCheckCanaries(segment->dynamicArray, segment->capacity))
+        {
+            return false;
+        }
+        #endif
+
+        #ifdef STACK_POISON
+        if (!arrayCheckPoison(segment->dynamicArray, segment->size, segment->capacity))
+        {
+            return false;
+        }
+        #endif
+
+        #ifdef STACK_ARRAY_HASHING
+        if (!arrayCheckHash(segment->dynamicArray, segment->size, segment->capacity))
+        {
+            return false;
+        }
+        #endif
+    }
+
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+//! Looks for errors in stack without modifying it, so stacks of other threads
+//! can be checked as long as they aren't modified at the same time. Pending
+//! errors in errorStatus aren't considered.
+//!
+//! @param [in]  stack   
+//! @param [in]  scanBuffer   whether or not to scan the whole dynamicArray
+//!                           (poison and hash checks)
+//! @param [in]  scanFrozen   whether or not to scan every frozen segment
+//!
+//! @return first error found or STACK_NO_ERROR if stack is working correctly.
+//-----------------------------------------------------------------------------
+StackErrors stackFindError(const Stack* stack, bool scanBuffer, bool scanFrozen)
+{
+    if (stack->status == STACK_STATUS_NOT_CONSTRUCTED)
+    {
+        return STACK_NOT_CONSTRUCTED_USE;
+    }
+
+    if (stack->status == STACK_STATUS_DESTRUCTED)
+    {
+        return STACK_DESTRUCTED_USE;
+    }
+
+    if (stack->size < 0 || stack->size > stack->capacity)
+    {
+        return STACK_MEMORY_CORRUPTION;
+    }
+
+    if (stack->dynamicArray == NULL)
+    {
+        return STACK_MEMORY_CORRUPTION;
+    }
+
+    if (!stackCheckFrozen(stack, scanFrozen))
+    {
+        return STACK_MEMORY_CORRUPTION;
+    }
+
+    #ifdef STACK_AGGREGATES_ENABLED
+    if (!stackCheckAggregates(stack))
+    {
+        return STACK_MEMORY_CORRUPTION;
+    }
+    #endif
+
+    if (stack->marksCount > stack->marksCapacity || (stack->marksCount > 0 && 
+       (stack->marks == NULL || stack->marks[stack->marksCount - 1].depth > stack->frozenSize + stack->size)))
+    {
+        return STACK_MEMORY_CORRUPTION;
+    }
+
+    #ifdef STACK_CANARIES_ENABLED
+    if (!stackCheckCanaries(stack))
+    {
+        return STACK_MEMORY_CORRUPTION;
+    }
+    #endif
+
+    if (!scanBuffer)
+    {
+        return STACK_NO_ERROR;
+    }
+
+    #ifdef STACK_POISON
+    if (!stackCheckPoison(stack))
+    {
+        return STACK_MEMORY_CORRUPTION;
+    }
+    #endif
+
+    #ifdef STACK_ARRAY_HASHING
+    if (!stackCheckHash(stack))
+    {
+        return STACK_MEMORY_CORRUPTION;
+    }
+    #endif
+
+    return STACK_NO_ERROR;
+}
+
+//-----------------------------------------------------------------------------
+//! Checks whether or not stack is working correctly and sets its errorStatus
+//! to the error found if it isn't.
+//!
+//! @param [out]  stack   
+//! @param [in]   scanBuffer   whether or not to scan the whole dynamicArray
+//!                            (poison and hash checks)
+//! @param [in]   scanFrozen   whether or not to scan every frozen segment
+//!
+//! @return whether or not stack is working correctly.
+//-----------------------------------------------------------------------------
+bool stackVerify(Stack* stack, bool scanBuffer, bool scanFrozen)
+{
+    assert(stack != NULL);
+
+    if (stack == NULL)
+    {
+        return false;
+    }
+
+    #ifdef STACK_SCRUBBER_ENABLED
+    stackTakeScrubError(stack);
+    #endif
+
+    if (stack->errorStatus != STACK_NO_ERROR)
+    {
+        return false;
+    }
+
+    stack->errorStatus = stackFindError(stack, scanBuffer, scanFrozen);
+
+    return stack->errorStatus == STACK_NO_ERROR;
+}
+
+//-----------------------------------------------------------------------------
+//! Checks whether or not stack is working correctly.
+//!
+//! @param [out]  stack   
+//!
+//! @note full scans of scrubbed stacks' dynamicArray are left to the 
+//!       scrubber and scans of frozen segments to stackAudit().
+//!
+//! @return whether or not stack is working correctly.
+//-----------------------------------------------------------------------------
+bool stackOk(Stack* stack)
+{
+    #ifdef STACK_SCRUBBER_ENABLED
+    return stackVerify(stack, !stack->scrubbed, false);
+    #else
+    return stackVerify(stack, true, false);
+    #endif
+}
+
+//-----------------------------------------------------------------------------
+//! Checks whether or not stack is working correctly, scanning its whole 
+//! dynamicArray and every frozen segment it references.
+//!
+//! @param [out]  stack   
+//!
+//! @note costs O(frozenSize + capacity), unlike stackOk().
+//!
+//! @return whether or not stack is working correctly.
+//-----------------------------------------------------------------------------
+bool stackAudit(Stack* stack)
+{
+    return stackVerify(stack, true, true);
+}
+
+#define STACK_ERROR_STRING(errorStatus) #errorStatus
+static const size_t STACK_DUMP_ERROR_STRING_LENGTH = 128;
+#define STACK_DUMP_CAT_ERROR_NAME_TO_ERROR_STRING(errorStatus) snprintf(&errorString[strlen(errorString)],                    \
+                                                                                     STACK_DUMP_ERROR_STRING_LENGTH - strlen(errorString), \
+                                                                                     STACK_ERROR_STRING(errorStatus));
+
+//-----------------------------------------------------------------------------
+//! Writes "NO_ERROR" or "ERROR <code>: <name>" for errorStatus to errorString
+//! of STACK_DUMP_ERROR_STRING_LENGTH bytes.
+//!
+//! @param [out]  errorString   
+//! @param [in]   errorStatus   
+//-----------------------------------------------------------------------------
+void dumpErrorString(char* errorString, StackErrors errorStatus)
+{
+    if (errorStatus == STACK_NO_ERROR)
+    {
+        snprintf(errorString, STACK_DUMP_ERROR_STRING_LENGTH, STACK_ERROR_STRING(STACK_NO_ERROR));
+    }
+    else
+    {
+        snprintf(errorString, STACK_DUMP_ERROR_STRING_LENGTH, "ERROR %d: ", errorStatus);
+
+        switch(errorStatus)
+        {
+            case STACK_POP_FROM_EMPTY:
+                STACK_DUMP_CAT_ERROR_NAME_TO_ERROR_STRING(STACK_POP_FROM_EMPTY);
+            break;
+
+            case STACK_TOP_FROM_EMPTY:
+                STACK_DUMP_CAT_ERROR_NAME_TO_ERROR_STRING(STACK_TOP_FROM_EMPTY);
+            break;
+
+            case STACK_CONSTRUCTION_FAILED:
+                STACK_DUMP_CAT_ERROR_NAME_TO_ERROR_STRING(STACK_CONSTRUCTION_FAILED);
+            break;
+
+            case STACK_REALLOCATION_FAILED:
+                STACK_DUMP_CAT_ERROR_NAME_TO_ERROR_STRING(STACK_REALLOCATION_FAILED);
+            break;
+
+            case STACK_NOT_CONSTRUCTED_USE:
+                STACK_DUMP_CAT_ERROR_NAME_TO_ERROR_STRING(STACK_NOT_CONSTRUCTED_USE);
+            break;
+
+            case STACK_DESTRUCTED_USE:
+                STACK_DUMP_CAT_ERROR_NAME_TO_ERROR_STRING(STACK_DESTRUCTED_USE);
+            break;
+
+            case STACK_MEMORY_CORRUPTION:
+                STACK_DUMP_CAT_ERROR_NAME_TO_ERROR_STRING(STACK_MEMORY_CORRUPTION);
+            break;
+
+            case STACK_MODIFIED_WHILE_VIEWED:
+                STACK_DUMP_CAT_ERROR_NAME_TO_ERROR_STRING(STACK_MODIFIED_WHILE_VIEWED);
+            break;
+
+            case STACK_INVALID_MARK:
+                STACK_DUMP_CAT_ERROR_NAME_TO_ERROR_STRING(STACK_INVALID_MARK);
+            break;
+
+            case STACK_NOT_ENOUGH_OPERANDS:
+                STACK_DUMP_CAT_ERROR_NAME_TO_ERROR_STRING(STACK_NOT_ENOUGH_OPERANDS);
+            break;
+
+            case STACK_SPILL_FAILED:
+                STACK_DUMP_CAT_ERROR_NAME_TO_ERROR_STRING(STACK_SPILL_FAILED);
+            break;
+
+            case STACK_VIEW_OF_FROZEN:
+                STACK_DUMP_CAT_ERROR_NAME_TO_ERROR_STRING(STACK_VIEW_OF_FROZEN);
+            break;
+
+            case STACK_DOMAIN_ERROR:
+                STACK_DUMP_CAT_ERROR_NAME_TO_ERROR_STRING(STACK_DOMAIN_ERROR);
+            break;
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+//! Uses logGenerator to dump stack to html log file as having errorStatus. 
+//!
+//! @param [in]  stack   
+//! @param [in]  errorStatus   
+//-----------------------------------------------------------------------------
+void dumpStack(const Stack* stack, StackErrors errorStatus)
+{
+    assert(stack != NULL);
+
+    if (!LG_IsInitialized())
+    {
+        LG_Init();
+    }
+
+    char errorString[STACK_DUMP_ERROR_STRING_LENGTH];
+    dumpErrorString(errorString, errorStatus);
+
+    LG_WriteMessageStart(LG_COLOR_BLACK);
+    LG_Write("Stack (");
+    LG_Write(errorString, errorStatus == STACK_NO_ERROR ? LG_COLOR_GREEN : LG_COLOR_RED);
+
+    if (errorStatus == STACK_NOT_CONSTRUCTED_USE || errorStatus == STACK_DESTRUCTED_USE)
+    {
+        LG_Write(") [0x%X] \n", stack);
+    }
+    else
+    {
+        LG_Write(") [0x%X] "
+
+                 #ifdef STACK_DEBUG_MODE
+                 "\"%s\""
+                 #endif
+
+                 "\n"
+                 "{\n"  
+
+                 #ifdef STACK_CANARIES_ENABLED
+                 "   canaryL: 0x%lX | must be 0x%lX\n"
+                 "   canaryR: 0x%lX | must be 0x%lX\n"
+                 #endif
+
+                 "   size         = %lu\n"
+                 "   capacity     = %lu\n"
+                 "   frozenSize   = %lu (frozen segment [0x%X])\n"
+                 "   dynamicArray [0x%X]\n"
+                 "   {\n"
+
+                 #ifdef STACK_CANARIES_ENABLED
+                 "       canaryL: 0x%lX | must be 0x%lX\n"
+                 "       canaryR: 0x%lX | must be 0x%lX\n"
+                 #endif
+
+                 #ifdef STACK_ARRAY_HASHING
+                 "       hash:    0x%lX (decimal = %lu)\n"
+                 #endif
+
+                 ,
+                 stack, 
+
+                 #ifdef STACK_DEBUG_MODE
+                 stack->name, 
+                 #endif
+
+                 #ifdef STACK_CANARIES_ENABLED
+                 stack->canaryL, STACK_STRUCT_CANARY_L,
+                 stack->canaryR, STACK_STRUCT_CANARY_R,
+                 #endif
+
+                 stack->size, 
+                 stack->capacity, 
+                 stack->frozenSize,
+                 stack->frozen,
+                 stack->dynamicArray
+                 
+                 #ifdef STACK_CANARIES_ENABLED
+                 ,getCanary((void*)stack->dynamicArray, stack->capacity * sizeof(elem_t), 'l'),
+                  STACK_ARRAY_CANARY_L,
+                  getCanary((void*)stack->dynamicArray, stack->capacity * sizeof(elem_t), 'r'),
+                  STACK_ARRAY_CANARY_R
+                 #endif  
+
+                 #ifdef STACK_ARRAY_HASHING
+                 ,(uint32_t*) &stack->dynamicArray[stack->capacity],
+                  (uint32_t*) &stack->dynamicArray[stack->capacity]
+                 #endif
+        );
+
+        for (size_t i = 0; i < stack->capacity; i++)
+        {
+            if (i < stack->size)
+            {
+                LG_Write("       *[%lu]\t= %lg ", 
+                         i, stack->dynamicArray[i]);
+            }
+            else
+            {
+                LG_Write("        [%lu]\t= %lg ", 
+                         i, stack->dynamicArray[i]);
+            }
+
+            #ifdef STACK_POISON
+            if (IS_STACK_POISON(stack->dynamicArray[i]))
+            {
+                LG_Write("(POISON!)");
+            }
+            #endif
+
+            LG_Write("\n");
+        }
+
+        LG_Write("   }\n");
+
+        #ifdef STACK_AGGREGATES_ENABLED
+        const StackAggregates* aggregates = &stack->aggregates;
+
+        if (stackAggregated(stack) && aggregates->size > 0 && aggregates->size <= aggregates->capacity)
+        {
+            LG_Write("   aggregates of %lu elements: min = %lg, max = %lg, sum = %lg\n", 
+                     aggregates->size,
+                     aggregates->tracks[STACK_TRACK_MIN][aggregates->size - 1],
+                     aggregates->tracks[STACK_TRACK_MAX][aggregates->size - 1],
+                     aggregates->tracks[STACK_TRACK_SUM][aggregates->size - 1] + 
+                     aggregates->tracks[STACK_TRACK_COMPENSATION][aggregates->size - 1]);
+        }
+        #endif
+
+        LG_Write("}\n");
+
+    }
+
+    LG_WriteMessageEnd();
+
+    if (errorStatus != STACK_NO_ERROR)
+    {
+        LG_Close();
+    }
+}
+
+//-----------------------------------------------------------------------------
+//! Uses logGenerator to dump stack to html log file. 
+//!
+//! @param [in]  stack   
+//-----------------------------------------------------------------------------
+void dump(Stack* stack)
+{
+    assert(stack != NULL);
+
+    dumpStack(stack, stack->errorStatus);
+}
+
+//-----------------------------------------------------------------------------
+//! Reports a failed stack check. Kept out of line and marked cold so that 
+//! the checks in ASSERT_STACK_OK cost only a branch on the hot path. Aborts 
+//! unless STACK_NON_FATAL_ERRORS is defined.
+//!
+//! @param [in]  stack   
+//-----------------------------------------------------------------------------
+void stackReportError(Stack* stack)
+{
+    if (stack != NULL)
+    {
+        dump(stack);
+    }
+
+    #ifndef STACK_NON_FATAL_ERRORS
+    assert(! "OK");
+    #endif
+}
+
+#ifdef STACK_CANARIES_ENABLED
+// Left canary takes the end of a RECORD_STACK_ALIGNMENT bytes long prefix so 
+// that the arena stays aligned.
+static const size_t RECORD_ARENA_OFFSET = RECORD_STACK_ALIGNMENT;
+#else
+static const size_t RECORD_ARENA_OFFSET = 0;
+#endif
+
+#ifdef STACK_POISON
+static const uint8_t RECORD_STACK_POISON = 0xCD;
+    #define PUT_RECORD_POISON(begin, end) memset(begin, RECORD_STACK_POISON, (end) - (begin))
+#else
+    #define PUT_RECORD_POISON(begin, end) 
+#endif
+
+#ifdef STACK_ARRAY_HASHING
+    #define RECORD_STACK_UPDATE_HASH(stack) recordStackUpdateHash(stack)
+
+void recordStackUpdateHash(RecordStack* stack)
+{
+    updateHash((void*)stack->arena, 
+               stack->capacity, 
+               (uint32_t*) (stack->arena + stack->capacity), 
+               stackHashBase(stack->size, stack->capacity));
+}
+
+#else
+    #define RECORD_STACK_UPDATE_HASH(stack) 
+#endif
+
+//-----------------------------------------------------------------------------
+//! @param [in]  capacity  
+//!
+//! @return size in bytes of the memory block holding an arena of capacity 
+//!         bytes together with its canaries and hash.
+//-----------------------------------------------------------------------------
+size_t recordBlockSize(size_t capacity)
+{
+    return RECORD_ARENA_OFFSET + capacity 
+
+           #ifdef STACK_ARRAY_HASHING
+           + sizeof(uint32_t)
+           #endif
+
+           #ifdef STACK_CANARIES_ENABLED
+           + sizeof(STACK_ARRAY_CANARY_R)
+           #endif
+           ;
+}
+
+//-----------------------------------------------------------------------------
+//! @param [in]  memBlock  
+//!
+//! @return arena stored in memBlock or NULL if memBlock is NULL.
+//-----------------------------------------------------------------------------
+uint8_t* recordArenaFromBlock(void* memBlock)
+{
+    if (memBlock == NULL)
+    {
+        return NULL;
+    }
+
+    return (uint8_t*) memBlock + RECORD_ARENA_OFFSET;
+}
+
+//-----------------------------------------------------------------------------
+//! @param [in]  size  
+//!
+//! @return size rounded up to a multiple of RECORD_STACK_ALIGNMENT.
+//-----------------------------------------------------------------------------
+size_t recordAlign(size_t size)
+{
+    return (size + RECORD_STACK_ALIGNMENT - 1) / RECORD_STACK_ALIGNMENT * RECORD_STACK_ALIGNMENT;
+}
+
+//-----------------------------------------------------------------------------
+//! @param [in]  length  
+//!
+//! @return bytes taken in the arena by a record of length bytes, including
+//!         its length header and footer.
+//-----------------------------------------------------------------------------
+size_t recordFootprint(size_t length)
+{
+    return 2 * sizeof(size_t) + recordAlign(length);
+}
+
+//-----------------------------------------------------------------------------
+//! @param [in]  stack  
+//! @param [in]  end    offset right after a record
+//!
+//! @return length of the record ending at end, read from its footer.
+//-----------------------------------------------------------------------------
+size_t recordLengthBefore(const RecordStack* stack, size_t end)
+{
+    return *(const size_t*) (stack->arena + end - sizeof(size_t));
+}
+
+//-----------------------------------------------------------------------------
+//! RecordStack's constructor. Allocates an arena of capacity bytes, rounded up
+//! to RECORD_STACK_ALIGNMENT.
+//!
+//! @param [out]  stack   
+//! @param [in]   capacity   
+//! @param [in]   stackName   
+//!
+//! @note if calloc returned NULL then sets stack's errorStatus to 
+//!       CONSTRUCTION_FAILED.
+//! @note if capacity is less than MINIMAL_RECORD_STACK_CAPACITY, than sets 
+//!       capacity to MINIMAL_RECORD_STACK_CAPACITY.
+//!
+//! @return stack if constructed successfully or NULL otherwise.
+//-----------------------------------------------------------------------------
+#ifdef STACK_DEBUG_MODE
+RecordStack* frecordStackConstruct(RecordStack* stack, size_t capacity, const char* stackName)
+#else
+RecordStack* frecordStackConstruct(RecordStack* stack, size_t capacity)
+#endif
+{
+    assert(stack != NULL);
+    assert(capacity > 0);
+
+    #ifdef STACK_DEBUG_MODE
+    stack->name = stackName;
+    #endif
+
+    stack->size         = 0;
+    stack->recordsCount = 0;
+    stack->capacity     = recordAlign(capacity > MINIMAL_RECORD_STACK_CAPACITY ? capacity : MINIMAL_RECORD_STACK_CAPACITY);
+    stack->arena        = recordArenaFromBlock(calloc(1, recordBlockSize(stack->capacity)));
+
+    if (stack->arena == NULL) 
+    {
+        stack->errorStatus = STACK_CONSTRUCTION_FAILED;
+        ASSERT_STACK_OK_OR_RETURN(stack, NULL);
+        return NULL;
+    }
+
+    PUT_RECORD_POISON(stack->arena, stack->arena + stack->capacity);
+    SET_CANARIES((void*)stack->arena, stack->capacity, STACK_ARRAY_CANARY_L, STACK_ARRAY_CANARY_R);
+    RECORD_STACK_UPDATE_HASH(stack);
+
+    stack->status = STACK_STATUS_CONSTRUCTED;
+    ASSERT_STACK_OK_OR_RETURN(stack, NULL);
+
+    return stack;
+}
+
+//-----------------------------------------------------------------------------
+//! RecordStack's destructor. Frees stack's arena.
+//!
+//! @param [out]  stack   
+//-----------------------------------------------------------------------------
+void recordStackDestruct(RecordStack* stack)
+{
+    #ifdef STACK_NON_FATAL_ERRORS
+    // A pending recoverable error must not keep the stack from being released.
+    if (stack != NULL)
+    {
+        stackClearError(stack);
+    }
+    #endif
+
+    ASSERT_STACK_OK(stack);
+
+    PUT_RECORD_POISON(stack->arena, stack->arena + stack->capacity);
+    free(stack->arena - RECORD_ARENA_OFFSET);
+
+    stack->size         = 0;
+    stack->capacity     = 0;
+    stack->recordsCount = 0;
+    stack->arena        = NULL;
+
+    stack->status = STACK_STATUS_DESTRUCTED;
+}
+
+//-----------------------------------------------------------------------------
+//! @param [in]  stack   
+//!
+//! @return number of records in stack.
+//-----------------------------------------------------------------------------
+size_t recordStackSize(RecordStack* stack)
+{
+    ASSERT_STACK_OK_OR_RETURN(stack, 0);
+
+    return stack->recordsCount;
+}
+
+//-----------------------------------------------------------------------------
+//! @param [in]  stack   
+//!
+//! @return bytes of the arena taken by records, including their headers and
+//!         padding.
+//-----------------------------------------------------------------------------
+size_t recordStackBytes(RecordStack* stack)
+{
+    ASSERT_STACK_OK_OR_RETURN(stack, 0);
+
+    return stack->size;
+}
+
+//-----------------------------------------------------------------------------
+//! @param [in]  stack   
+//!
+//! @return current stack's errorStatus.
+//-----------------------------------------------------------------------------
+StackErrors stackErrorStatus(RecordStack* stack)
+{
+    assert(stack != NULL);
+
+    return stack->errorStatus;
+}
+
+//-----------------------------------------------------------------------------
+//! @param [in]  stack   
+//!
+//! @return status returned by StackErrors functions if stack failed the 
+//!         check in ASSERT_STACK_OK_OR_RETURN.
+//-----------------------------------------------------------------------------
+StackErrors stackFailureStatus(RecordStack* stack)
+{
+    return stack == NULL ? STACK_NOT_CONSTRUCTED_USE : failureStatus(stack->errorStatus);
+}
+
+//-----------------------------------------------------------------------------
+//! Resets stack's errorStatus to NO_ERROR if the error left the stack intact,
+//! see stackClearError(Stack*).
+//!
+//! @param [out]  stack   
+//!
+//! @return whether or not stack has no error after the call.
+//-----------------------------------------------------------------------------
+bool stackClearError(RecordStack* stack)
+{
+    assert(stack != NULL);
+
+    return clearRecoverableError(&stack->errorStatus);
+}
+
+//-----------------------------------------------------------------------------
+//! Resizes stack's arena to newCapacity bytes. If reallocation was 
+//! unsuccessful, returns NULL and sets stack's errorStatus to 
+//! REALLOCATION_FAILED, but current records of the stack won't be removed.
+//!
+//! @param [out]  stack   
+//! @param [in]   newCapacity   a multiple of RECORD_STACK_ALIGNMENT not less 
+//!                             than stack's size
+//!
+//! @return pointer to the new stack's arena if reallocation was successful 
+//!         or NULL otherwise.
+//-----------------------------------------------------------------------------
+uint8_t* recordStackResize(RecordStack* stack, size_t newCapacity)
+{
+    assert(newCapacity >= stack->size);
+
+    uint8_t* newArena = recordArenaFromBlock(realloc(stack->arena - RECORD_ARENA_OFFSET, 
+                                                     recordBlockSize(newCapacity)));
+
+    if (newArena == NULL)
+    {
+        stack->errorStatus = STACK_REALLOCATION_FAILED;
+        ASSERT_STACK_OK_OR_RETURN(stack, NULL);
+        return NULL;
+    }
+
+    stack->arena    = newArena;
+    stack->capacity = newCapacity;
+
+    PUT_RECORD_POISON(stack->arena + stack->size, stack->arena + stack->capacity);
+    SET_CANARY((void*)stack->arena, stack->capacity, STACK_ARRAY_CANARY_R, 'r');
+    RECORD_STACK_UPDATE_HASH(stack);
+
+    return newArena;
+}
+
+//-----------------------------------------------------------------------------
+//! Copies length bytes from record to the top of the stack. The arena grows 
+//! by STACK_EXPAND_MULTIPLIER (or more, if the record doesn't fit), so no 
+//! allocation is done per record.
+//!
+//! @param [out]  stack   
+//! @param [in]   record   may be NULL if length is 0, may point to a record
+//!                        of stack itself (e.g. from recordStackTop())
+//! @param [in]   length   
+//!
+//! @note if realloc returned NULL then sets stack's errorStatus to 
+//!       REALLOCATION_FAILED.
+//!
+//! @return NO_ERROR if pushed successfully or some STACK_ERRORS code 
+//!         otherwise.
+//-----------------------------------------------------------------------------
+StackErrors recordStackPush(RecordStack* stack, const void* record, size_t length)
+{
+    ASSERT_STACK_OK_OR_RETURN(stack, stackFailureStatus(stack));
+    assert(record != NULL || length == 0);
+
+    if (STACK_UNLIKELY(length > SIZE_MAX / 4))
+    {
+        stack->errorStatus = STACK_REALLOCATION_FAILED;
+        ASSERT_STACK_OK_OR_RETURN(stack, STACK_REALLOCATION_FAILED);
+        return STACK_REALLOCATION_FAILED;
+    }
+
+    size_t footprint = recordFootprint(length);
+
+    if (STACK_UNLIKELY(stack->capacity - stack->size < footprint))
+    {
+        size_t newCapacity = stack->capacity * STACK_EXPAND_MULTIPLIER;
+        if (newCapacity < stack->size + footprint)
+        {
+            newCapacity = stack->size + footprint;
+        }
+
+        // The arena may move, so a record taken from it is found again by offset
+        uintptr_t recordAddress = (uintptr_t) record;
+        uintptr_t arenaAddress  = (uintptr_t) stack->arena;
+        bool      inArena       = recordAddress >= arenaAddress && recordAddress < arenaAddress + stack->size;
+
+        if (recordStackResize(stack, recordAlign(newCapacity)) == NULL)
+        {
+            return STACK_REALLOCATION_FAILED;
+        }
+
+        if (inArena)
+        {
+            record = stack->arena + (recordAddress - arenaAddress);
+        }
+    }
+
+    uint8_t* header  = stack->arena + stack->size;
+    uint8_t* payload = header + sizeof(size_t);
+    uint8_t* footer  = header + footprint - sizeof(size_t);
+
+    *(size_t*) header = length;
+    *(size_t*) footer = length;
+
+    if (length > 0)
+    {
+        memcpy(payload, record, length);
+    }
+
+    memset(payload + length, 0, footer - payload - length);
+
+    stack->size += footprint;
+    stack->recordsCount++;
+
+    RECORD_STACK_UPDATE_HASH(stack);
+    ASSERT_STACK_OK_OR_RETURN(stack, stackFailureStatus(stack));
+
+    return STACK_NO_ERROR;
+}
+
+//-----------------------------------------------------------------------------
+//! Returns the record on top of the stack. The record stays in the arena, so 
+//! the pointer is valid until the next push, pop or release (though it can 
+//! be pushed itself). Returns NULL if the stack is empty.
+//!
+//! @param [in]   stack    
+//! @param [out]  length   length of the record, may be NULL
+//!
+//! @note if top is called from an empty stack then sets the stack's 
+//!       errorStatus to TOP_FROM_EMPTY.
+//!
+//! @return pointer to the record on top of the stack.
+//-----------------------------------------------------------------------------
+const void* recordStackTop(RecordStack* stack, size_t* length)
+{
+    ASSERT_STACK_OK_OR_RETURN(stack, NULL);
+
+    if (STACK_UNLIKELY(stack->recordsCount == 0))
+    {
+        stack->errorStatus = STACK_TOP_FROM_EMPTY;
+        ASSERT_STACK_OK_OR_RETURN(stack, NULL);
+        return NULL;
+    }
+
+    size_t recordLength = recordLengthBefore(stack, stack->size);
+    if (length != NULL)
+    {
+        *length = recordLength;
+    }
+
+    return stack->arena + stack->size - recordFootprint(recordLength) + sizeof(size_t);
+}
+
+//-----------------------------------------------------------------------------
+//! Removes the record on top of the stack, see recordStackRelease().
+//!
+//! @param [out]  stack    
+//!
+//! @return NO_ERROR if popped successfully or some STACK_ERRORS code 
+//!         otherwise.
+//-----------------------------------------------------------------------------
+StackErrors recordStackPop(RecordStack* stack)
+{
+    return recordStackRelease(stack, 1);
+}
+
+//-----------------------------------------------------------------------------
+//! Removes count records from the top of the stack at once. Only the top 
+//! pointer is moved, the arena is never shrunk, so released space is reused
+//! by following pushes.
+//!
+//! @param [out]  stack    
+//! @param [in]   count    
+//!
+//! @note if stack has less than count records then nothing is removed and 
+//!       the stack's errorStatus is set to POP_FROM_EMPTY.
+//!
+//! @return NO_ERROR if released successfully or some STACK_ERRORS code 
+//!         otherwise.
+//-----------------------------------------------------------------------------
+StackErrors recordStackRelease(RecordStack* stack, size_t count)
+{
+    ASSERT_STACK_OK_OR_RETURN(stack, stackFailureStatus(stack));
+
+    if (STACK_UNLIKELY(count > stack->recordsCount))
+    {
+        stack->errorStatus = STACK_POP_FROM_EMPTY;
+        ASSERT_STACK_OK_OR_RETURN(stack, STACK_POP_FROM_EMPTY);
+        return STACK_POP_FROM_EMPTY;
+    }
+
+    size_t newSize = stack->size;
+    for (size_t i = 0; i < count; i++)
+    {
+        newSize -= recordFootprint(recordLengthBefore(stack, newSize));
+    }
+
+    PUT_RECORD_POISON(stack->arena + newSize, stack->arena + stack->size);
+
+    stack->size          = newSize;
+    stack->recordsCount -= count;
+
+    RECORD_STACK_UPDATE_HASH(stack);
+    ASSERT_STACK_OK_OR_RETURN(stack, stackFailureStatus(stack));
+
+    return STACK_NO_ERROR;
+}
+
+//-----------------------------------------------------------------------------
+//! Removes all records from the stack. The arena keeps its capacity.
+//!
+//! @param [out]  stack   
+//-----------------------------------------------------------------------------
+void recordStackClear(RecordStack* stack)
+{
+    ASSERT_STACK_OK(stack);
+
+    PUT_RECORD_POISON(stack->arena, stack->arena + stack->size);
+
+    stack->size         = 0;
+    stack->recordsCount = 0;
+
+    RECORD_STACK_UPDATE_HASH(stack);
+    ASSERT_STACK_OK(stack);
+}
+
+#ifdef STACK_CANARIES_ENABLED
+//-----------------------------------------------------------------------------
+//! @param [in]  stack   
+//!
+//! @return whether or not canaries of stack and of its arena are intact.
+//-----------------------------------------------------------------------------
+bool recordStackCheckCanaries(const RecordStack* stack)
+{
+    return getCanary((void*)stack->arena, stack->capacity, 'l') == STACK_ARRAY_CANARY_L &&
+           getCanary((void*)stack->arena, stack->capacity, 'r') == STACK_ARRAY_CANARY_R &&
+           stack->canaryL == STACK_STRUCT_CANARY_L                                      &&
+           stack->canaryR == STACK_STRUCT_CANARY_R;
+}
+#endif
+
+#ifdef STACK_POISON
+//-----------------------------------------------------------------------------
+//! @param [in]  stack   
+//!
+//! @return offset of the first unused byte of stack's arena that isn't 
+//!         POISON or stack's capacity if there is none.
+//-----------------------------------------------------------------------------
+size_t recordStackFindUnpoisoned(const RecordStack* stack)
+{
+    size_t offset = stack->size;
+
+    while (offset < stack->capacity && stack->arena[offset] == RECORD_STACK_POISON)
+    {
+        offset++;
+    }
+
+    return offset;
+}
+#endif
+
+#ifdef STACK_ARRAY_HASHING
+//-----------------------------------------------------------------------------
+//! @param [in]  stack   
+//!
+//! @return whether or not the hash stored after stack's arena is correct.
+//-----------------------------------------------------------------------------
+bool recordStackCheckHash(const RecordStack* stack)
+{
+    return *(const uint32_t*) (stack->arena + stack->capacity) == 
+           computeHash(stack->arena, stack->capacity, stackHashBase(stack->size, stack->capacity));
+}
+#endif
+
+//-----------------------------------------------------------------------------
+//! Looks for errors in record stack without modifying it. Besides canaries,
+//! poison and hash checks that the top record's header and footer agree.
+//! Pending errors in errorStatus aren't considered.
+//!
+//! @param [in]  stack   
+//!
+//! @return first error found or STACK_NO_ERROR if stack is working correctly.
+//-----------------------------------------------------------------------------
+StackErrors recordStackFindError(const RecordStack* stack)
+{
+    if (stack->status == STACK_STATUS_NOT_CONSTRUCTED)
+    {
+        return STACK_NOT_CONSTRUCTED_USE;
+    }
+
+    if (stack->status == STACK_STATUS_DESTRUCTED)
+    {
+        return STACK_DESTRUCTED_USE;
+    }
+
+    if (stack->arena == NULL || stack->size > stack->capacity || 
+        stack->size % RECORD_STACK_ALIGNMENT != 0 || (stack->size == 0) != (stack->recordsCount == 0))
+    {
+        return STACK_MEMORY_CORRUPTION;
+    }
+
+    if (stack->size > 0)
+    {
+        size_t length = recordLengthBefore(stack, stack->size);
+
+        if (length > stack->size || recordFootprint(length) > stack->size ||
+            *(const size_t*) (stack->arena + stack->size - recordFootprint(length)) != length)
+        {
+            return STACK_MEMORY_CORRUPTION;
+        }
+    }
+
+    #ifdef STACK_CANARIES_ENABLED
+    if (!recordStackCheckCanaries(stack))
+    {
+        return STACK_MEMORY_CORRUPTION;
+    }
+    #endif
+
+    #ifdef STACK_POISON
+    if (recordStackFindUnpoisoned(stack) != stack->capacity)
+    {
+        return STACK_MEMORY_CORRUPTION;
+    }
+    #endif
+
+    #ifdef STACK_ARRAY_HASHING
+    if (!recordStackCheckHash(stack))
+    {
+        return STACK_MEMORY_CORRUPTION;
+    }
+    #endif
+
+    return STACK_NO_ERROR;
+}
+
+//-----------------------------------------------------------------------------
+//! Checks whether or not record stack is working correctly and sets its 
+//! errorStatus to the error found if it isn't.
+//!
+//! @param [out]  stack   
+//!
+//! @return whether or not stack is working correctly.
+//-----------------------------------------------------------------------------
+bool stackOk(RecordStack* stack)
+{
+    assert(stack != NULL);
+
+    if (stack == NULL)
+    {
+        return false;
+    }
+
+    if (stack->errorStatus != STACK_NO_ERROR)
+    {
+        return false;
+    }
+
+    stack->errorStatus = recordStackFindError(stack);
+
+    return stack->errorStatus == STACK_NO_ERROR;
+}
+
+//-----------------------------------------------------------------------------
+//! Uses logGenerator to dump record stack to html log file. 
+//!
+//! @param [out]  stack   
+//-----------------------------------------------------------------------------
+void dump(RecordStack* stack)
+{
+    assert(stack != NULL);
+
+    if (!LG_IsInitialized())
+    {
+        LG_Init();
+    }
+
+    char errorString[STACK_DUMP_ERROR_STRING_LENGTH];
+    dumpErrorString(errorString, stack->errorStatus);
+
+    LG_WriteMessageStart(LG_COLOR_BLACK);
+    LG_Write("RecordStack (");
+    LG_Write(errorString, stack->errorStatus == STACK_NO_ERROR ? LG_COLOR_GREEN : LG_COLOR_RED);
+
+    if (stack->errorStatus == STACK_NOT_CONSTRUCTED_USE || stack->errorStatus == STACK_DESTRUCTED_USE ||
+        stack->arena == NULL)
+    {
+        LG_Write(") [0x%X] \n", stack);
+    }
+    else
+    {
+        LG_Write(") [0x%X] "
+
+                 #ifdef STACK_DEBUG_MODE
+                 "\"%s\""
+                 #endif
+
+                 "\n"
+                 "{\n"  
+
+                 #ifdef STACK_CANARIES_ENABLED
+                 "   canaryL: 0x%lX | must be 0x%lX\n"
+                 "   canaryR: 0x%lX | must be 0x%lX\n"
+                 #endif
+
+                 "   recordsCount = %lu\n"
+                 "   size         = %lu bytes\n"
+                 "   capacity     = %lu bytes\n"
+                 "   arena [0x%X]\n"
+                 "   {\n"
+
+                 #ifdef STACK_CANARIES_ENABLED
+                 "       canaryL: 0x%lX | must be 0x%lX\n"
+                 "       canaryR: 0x%lX | must be 0x%lX\n"
+                 #endif
+
+                 #ifdef STACK_ARRAY_HASHING
+                 "       hash:    0x%lX (decimal = %lu)\n"
+                 #endif
+
+                 ,
+                 stack, 
+
+                 #ifdef STACK_DEBUG_MODE
+                 stack->name, 
+                 #endif
+
+                 #ifdef STACK_CANARIES_ENABLED
+                 stack->canaryL, STACK_STRUCT_CANARY_L,
+                 stack->canaryR, STACK_STRUCT_CANARY_R,
+                 #endif
+
+                 stack->recordsCount, 
+                 stack->size, 
+                 stack->capacity, 
+                 stack->arena
+                 
+                 #ifdef STACK_CANARIES_ENABLED
+                 ,getCanary((void*)stack->arena, stack->capacity, 'l'),
+                  STACK_ARRAY_CANARY_L,
+                  getCanary((void*)stack->arena, stack->capacity, 'r'),
+                  STACK_ARRAY_CANARY_R
+                 #endif  
+
+                 #ifdef STACK_ARRAY_HASHING
+                 ,*(uint32_t*) (stack->arena + stack->capacity),
+                  *(uint32_t*) (stack->arena + stack->capacity)
+                 #endif
+        );
+
+        size_t offset = 0;
+        for (size_t i = 0; offset < stack->size && offset < stack->capacity; i++)
+        {
+            size_t length = *(size_t*) (stack->arena + offset);
+
+            LG_Write("       *[%lu]\t offset = %lu, length = %lu\n", i, offset, length);
+
+            if (length > stack->capacity - offset)
+            {
+                LG_Write("        (length is out of the arena!)\n");
+                break;
+            }
+
+            offset += recordFootprint(length);
+        }
+
+        #ifdef STACK_POISON
+        size_t unpoisoned = recordStackFindUnpoisoned(stack);
+        if (unpoisoned != stack->capacity)
+        {
+            LG_Write("        [%lu]\t is unused, but has no POISON!\n", unpoisoned);
+        }
+        #endif
+
+        LG_Write("   }\n"
+                 "}\n");
+    }
+
+    LG_WriteMessageEnd();
+
+    if (stack->errorStatus != STACK_NO_ERROR)
+    {
+        LG_Close();
+    }
+}
+
+//-----------------------------------------------------------------------------
+//! Reports a failed record stack check, see stackReportError(Stack*).
+//!
+//! @param [in]  stack   
+//-----------------------------------------------------------------------------
+void stackReportError(RecordStack* stack)
+{
+    if (stack != NULL)
+    {
+        dump(stack);
+    }
+
+    #ifndef STACK_NON_FATAL_ERRORS
+    assert(! "OK");
+    #endif
+}
+
+#ifdef STACK_SCRUBBER_ENABLED
+
+struct StackRetiredBlock
+{
+    void*              memBlock = NULL;
+    StackRetiredBlock* next     = NULL;
+};
+
+// scrubberMutex guards the list of scrubbed stacks and is held during the whole
+// scrub pass, scrubberThreadMutex guards the scrubber thread's state.
+static std::mutex                      scrubberMutex;
+static std::mutex                      scrubberThreadMutex;
+static std::condition_variable         scrubberWakeUp;
+static std::thread                     scrubberThread;
+static bool                            scrubberRunning      = false;
+static unsigned                        scrubberPeriodMs     = 0;
+static StackCorruptionCallback         scrubberCallback     = NULL;
+static void*                           scrubberUserData     = NULL;
+static Stack*                          scrubbedStacks       = NULL;
+static std::atomic<StackRetiredBlock*> retiredBlocks        {NULL};
+static uint32_t*                       scrubberSnapshot     = NULL; // see stackScrubCheck()
+static size_t                          scrubberSnapshotSize = 0;
+
+//-----------------------------------------------------------------------------
+//! Defers freeing of memBlock until the end of the current scrub pass, as the
+//! scrubber may still be reading it. Never blocks unless out of memory.
+//!
+//! @param [in]  memBlock  
+//-----------------------------------------------------------------------------
+void stackScrubberRetire(void* memBlock)
+{
+    StackRetiredBlock* retired = (StackRetiredBlock*) calloc(1, sizeof(StackRetiredBlock));
+
+    if (retired == NULL)
+    {
+        std::lock_guard<std::mutex> lock(scrubberMutex);
+        freeBlock(memBlock);
+        return;
+    }
+
+    retired->memBlock = memBlock;
+    retired->next     = retiredBlocks.load(std::memory_order_relaxed);
+
+    while (!retiredBlocks.compare_exchange_weak(retired->next, retired, 
+                                                std::memory_order_release, 
+                                                std::memory_order_relaxed));
+}
+
+//-----------------------------------------------------------------------------
+//! If first or second is scrubbed, waits for the current scrub pass to end 
+//! and keeps next ones from starting until the returned lock is released. 
+//! Buffers taken away from scrubbed stacks (other than by resizeArray(), 
+//! which retires them) may be freed by their new owner at any moment, so this
+//! must be held while they are taken away.
+//!
+//! @param [in]  first  
+//! @param [in]  second  may be NULL
+//!
+//! @return lock of scrubberMutex, which doesn't own it if neither stack is 
+//!         scrubbed.
+//-----------------------------------------------------------------------------
+std::unique_lock<std::mutex> stackScrubberQuiesce(const Stack* first, const Stack* second)
+{
+    if (first->scrubbed || (second != NULL && second->scrubbed))
+    {
+        return std::unique_lock<std::mutex>(scrubberMutex);
+    }
+
+    return std::unique_lock<std::mutex>();
+}
+
+//-----------------------------------------------------------------------------
+//! Frees all retired memory blocks. Must be called with scrubberMutex locked.
+//-----------------------------------------------------------------------------
+void stackScrubberFreeRetired()
+{
+    StackRetiredBlock* retired = retiredBlocks.exchange(NULL, std::memory_order_acquire);
+
+    while (retired != NULL)
+    {
+        StackRetiredBlock* next = retired->next;
+
+        freeBlock(retired->memBlock);
+        free(retired);
+
+        retired = next;
+    }
+}
+
+//-----------------------------------------------------------------------------
+//! Adds stack to the list of stacks verified by the scrubber. Poison and hash
+//! of a scrubbed stack are no longer checked inline by ASSERT_STACK_OK, and 
+//! its hash is no longer updated on every modification, the scrubber keeps it
+//! instead.
+//!
+//! @param [out]  stack  
+//!
+//! @note must be called from the thread owning the stack.
+//-----------------------------------------------------------------------------
+void stackScrubberRegister(Stack* stack)
+{
+    ASSERT_STACK_OK(stack);
+
+    std::lock_guard<std::mutex> lock(scrubberMutex);
+
+    if (stack->scrubbed)
+    {
+        return;
+    }
+
+    stack->scrubPrev = NULL;
+    stack->scrubNext = scrubbedStacks;
+
+    if (scrubbedStacks != NULL)
+    {
+        scrubbedStacks->scrubPrev = stack;
+    }
+
+    scrubbedStacks  = stack;
+    stack->scrubbed = true;
+
+    #ifdef STACK_ARRAY_HASHING
+    // Just checked, so the scrubber starts from the stored hash
+    stack->scrubHashed   = true;
+    stack->scrubHash     = *(const uint32_t*) &stack->dynamicArray[stack->capacity];
+    stack->scrubSequence = stack->sequence.load(std::memory_order_relaxed);
+    #endif
+}
+
+//-----------------------------------------------------------------------------
+//! Removes stack from the list of stacks verified by the scrubber. Waits for
+//! the current scrub pass to end. Unlike stackScrubberUnregister() leaves the
+//! hash stored after stack's dynamicArray as it is.
+//!
+//! @param [out]  stack  
+//!
+//! @return whether or not the stack was scrubbed.
+//-----------------------------------------------------------------------------
+bool stackScrubberRemove(Stack* stack)
+{
+    std::lock_guard<std::mutex> lock(scrubberMutex);
+
+    if (!stack->scrubbed)
+    {
+        return false;
+    }
+
+    if (stack->scrubPrev != NULL)
+    {
+        stack->scrubPrev->scrubNext = stack->scrubNext;
     }
     else
     {
-        snprintf(errorString, STACK_DUMP_ERROR_STRING_LENGTH, "ERROR %d: ", stack->errorStatus);
+        scrubbedStacks = stack->scrubNext;
+    }
+
+    if (stack->scrubNext != NULL)
+    {
+        stack->scrubNext->scrubPrev = stack->scrubPrev;
+    }
+
+    stack->scrubPrev = NULL;
+    stack->scrubNext = NULL;
+    stack->scrubbed  = false;
+
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+//! Removes stack from the list of stacks verified by the scrubber and takes 
+//! its hash back from the scrubber. Waits for the current scrub pass to end.
+//!
+//! @param [out]  stack  
+//!
+//! @note must be called from the thread owning the stack.
+//-----------------------------------------------------------------------------
+void stackScrubberUnregister(Stack* stack)
+{
+    assert(stack != NULL);
+
+    if (!stackScrubberRemove(stack))
+    {
+        return;
+    }
+
+    #ifdef STACK_ARRAY_HASHING
+    if (stack->dynamicArray != NULL)
+    {
+        uint32_t hash = computeHash(stack->dynamicArray, 
+                                    stack->capacity * sizeof(elem_t), 
+                                    stackHashBase(stack->size, stack->capacity));
+
+        // Corruption since the last pass mustn't be hidden by the new hash
+        if (stack->scrubHashed && stack->scrubHash != hash &&
+            stack->scrubSequence == stack->sequence.load(std::memory_order_relaxed))
+        {
+            stack->scrubError.store(STACK_MEMORY_CORRUPTION, std::memory_order_relaxed);
+        }
+
+        *(uint32_t*) &stack->dynamicArray[stack->capacity] = hash;
+    }
+
+    stack->scrubHashed = false;
+    #endif
+}
+
+//-----------------------------------------------------------------------------
+//! Makes the scrubber's snapshot buffer hold at least size bytes. Must be 
+//! called with scrubberMutex locked.
+//!
+//! @param [in]  size  
+//!
+//! @return whether or not the buffer is large enough.
+//-----------------------------------------------------------------------------
+bool stackScrubberReserve(size_t size)
+{
+    if (size <= scrubberSnapshotSize)
+    {
+        return true;
+    }
+
+    void* snapshot = realloc(scrubberSnapshot, size);
+
+    if (snapshot == NULL)
+    {
+        return false;
+    }
+
+    scrubberSnapshot     = (uint32_t*) snapshot;
+    scrubberSnapshotSize = size;
+
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+//! Verifies canaries, poison and hash of the stack's dynamicArray. The stack 
+//! may be modified by its owner at the same time, so its fields and buffer 
+//! are only read with relaxed atomic loads into a snapshot, which is checked 
+//! if the stack turns out to be left unmodified. Must be called with 
+//! scrubberMutex locked.
+//!
+//! The hash is checked against the one computed by the previous check, if the
+//! stack hasn't been modified since then, or kept for the next check 
+//! otherwise. These are the only fields of the stack written here.
+//!
+//! @param [in]   stack  
+//! @param [out]  error   STACK_MEMORY_CORRUPTION if the stack is corrupted or
+//!                       STACK_NO_ERROR otherwise
+//!
+//! @return whether or not the stack was left unmodified during the check, 
+//!         i.e. whether or not error is valid.
+//-----------------------------------------------------------------------------
+bool stackScrubCheck(Stack* stack, StackErrors* error)
+{
+    *error = STACK_NO_ERROR;
+
+    uint32_t sequence = stack->sequence.load(std::memory_order_acquire);
+    if (sequence % 2 != 0)
+    {
+        return false;
+    }
+
+    size_t  size         = STACK_RELAXED_LOAD(stack->size);
+    size_t  capacity     = STACK_RELAXED_LOAD(stack->capacity);
+    elem_t* dynamicArray = STACK_RELAXED_LOAD(stack->dynamicArray);
+
+    bool corrupted = false;
+
+    #ifdef STACK_CANARIES_ENABLED
+    corrupted = STACK_RELAXED_LOAD(stack->canaryL) != STACK_STRUCT_CANARY_L ||
+                STACK_RELAXED_LOAD(stack->canaryR) != STACK_STRUCT_CANARY_R;
+    #endif
+
+    // The buffer can be touched only if the snapshot above is consistent
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (stack->sequence.load(std::memory_order_relaxed) != sequence)
+    {
+        return false;
+    }
+
+    if (corrupted || size > capacity || dynamicArray == NULL)
+    {
+        *error = STACK_MEMORY_CORRUPTION;
+        return true;
+    }
+
+    // Without poison there is nothing to check in the buffer
+    #ifdef STACK_POISON
+    size_t blockSize = arrayBlockSize(capacity);
+
+    if (!stackScrubberReserve(blockSize))
+    {
+        return false;
+    }
+
+    const uint32_t* block = (const uint32_t*) arrayBlockBegin(dynamicArray);
+
+    for (size_t word = 0; word < blockSize / sizeof(uint32_t); word++)
+    {
+        scrubberSnapshot[word] = STACK_RELAXED_LOAD(block[word]);
+    }
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (stack->sequence.load(std::memory_order_relaxed) != sequence)
+    {
+        return false;
+    }
+
+    elem_t* snapshot = arrayFromBlock(scrubberSnapshot);
+
+    #ifdef STACK_CANARIES_ENABLED
+    corrupted = corrupted || !arrayCheckCanaries(snapshot, capacity);
+    #endif
+
+    corrupted = corrupted || !arrayCheckPoison(snapshot, size, capacity);
+
+    #ifdef STACK_ARRAY_HASHING
+    uint32_t hash = computeHash(snapshot, capacity * sizeof(elem_t), stackHashBase(size, capacity));
+
+    if (stack->scrubHashed && stack->scrubSequence == sequence)
+    {
+        corrupted = corrupted || hash != stack->scrubHash;
+    }
+    else if (!corrupted)
+    {
+        stack->scrubHashed   = true;
+        stack->scrubHash     = hash;
+        stack->scrubSequence = sequence;
+    }
+    #endif
+    #endif
+
+    if (corrupted)
+    {
+        *error = STACK_MEMORY_CORRUPTION;
+    }
+
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+//! Verifies all registered stacks once on the calling thread. Corrupted stacks
+//! are reported to the scrubber's callback and get errorStatus 
+//! MEMORY_CORRUPTION (and are dumped) on their owner's next check, the stacks
+//! themselves are never written to here. Stacks that keep being modified 
+//! during STACK_SCRUB_MAX_ATTEMPTS attempts are skipped until the next pass,
+//! as are stacks with an error their owner hasn't taken over yet.
+//!
+//! @note the callback is called after the pass, when stacks can already be 
+//!       unregistered or destructed, so it should only use the stack's 
+//!       address to identify it. It mustn't run scrub passes itself.
+//!
+//! @return number of corrupted stacks found.
+//-----------------------------------------------------------------------------
+size_t stackScrubberRunPass()
+{
+    std::unique_lock<std::mutex> lock(scrubberMutex);
+
+    StackCorruptionCallback callback = scrubberCallback;
+    void*                   userData = scrubberUserData;
+
+    Stack** corrupted      = NULL;
+    size_t  corruptedCount = 0;
+    size_t  reportedCount  = 0;
+
+    for (Stack* stack = scrubbedStacks; stack != NULL; stack = stack->scrubNext)
+    {
+        StackErrors error = STACK_NO_ERROR;
+
+        if (stack->scrubError.load(std::memory_order_relaxed) != STACK_NO_ERROR)
+        {
+            continue;
+        }
+
+        for (unsigned attempt = 0; attempt < STACK_SCRUB_MAX_ATTEMPTS; attempt++)
+        {
+            if (stackScrubCheck(stack, &error))
+            {
+                break;
+            }
+
+            std::this_thread::yield();
+        }
+
+        if (error != STACK_NO_ERROR)
+        {
+            stack->scrubError.store(error, std::memory_order_release);
+
+            // Reports that don't fit are dropped, the errors are still set
+            if (callback != NULL)
+            {
+                Stack** reported = (Stack**) realloc(corrupted, (reportedCount + 1) * sizeof(Stack*));
+
+                if (reported != NULL)
+                {
+                    corrupted = reported;
+                    corrupted[reportedCount++] = stack;
+                }
+            }
+
+            corruptedCount++;
+        }
+    }
+
+    stackScrubberFreeRetired();
+
+    lock.unlock();
+
+    for (size_t i = 0; i < reportedCount; i++)
+    {
+        callback(corrupted[i], STACK_MEMORY_CORRUPTION, userData);
+    }
+
+    free(corrupted);
+
+    return corruptedCount;
+}
+
+//-----------------------------------------------------------------------------
+//! Scrubber thread's main loop.
+//-----------------------------------------------------------------------------
+void stackScrubberLoop()
+{
+    std::unique_lock<std::mutex> lock(scrubberThreadMutex);
+
+    while (scrubberRunning)
+    {
+        scrubberWakeUp.wait_for(lock, std::chrono::milliseconds(scrubberPeriodMs));
+
+        if (scrubberRunning)
+        {
+            lock.unlock();
+            stackScrubberRunPass();
+            lock.lock();
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+//! Starts the scrubber thread that runs stackScrubberRunPass() every periodMs
+//! milliseconds.
+//!
+//! @param [in]  periodMs   DEFAULT_STACK_SCRUB_PERIOD_MS is used if 0
+//! @param [in]  callback   called for every corrupted stack, can be NULL
+//! @param [in]  userData   passed to callback
+//!
+//! @return whether or not the scrubber was started (false if it's already
+//!         running or the thread couldn't be created).
+//-----------------------------------------------------------------------------
+bool stackScrubberStart(unsigned periodMs, StackCorruptionCallback callback, void* userData)
+{
+    std::lock_guard<std::mutex> threadLock(scrubberThreadMutex);
+
+    if (scrubberRunning)
+    {
+        return false;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(scrubberMutex);
+        scrubberCallback = callback;
+        scrubberUserData = userData;
+    }
+
+    scrubberPeriodMs = periodMs > 0 ? periodMs : DEFAULT_STACK_SCRUB_PERIOD_MS;
+    scrubberRunning  = true;
+
+    try
+    {
+        scrubberThread = std::thread(stackScrubberLoop);
+    }
+    catch (...)
+    {
+        scrubberRunning = false;
+        return false;
+    }
+
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+//! Stops the scrubber thread and waits for it to finish. Registered stacks 
+//! stay registered.
+//-----------------------------------------------------------------------------
+void stackScrubberStop()
+{
+    {
+        std::lock_guard<std::mutex> threadLock(scrubberThreadMutex);
 
-        switch(stack->errorStatus)
+        if (!scrubberRunning)
         {
-            case STACK_POP_FROM_EMPTY:
-                STACK_DUMP_CAT_ERROR_NAME_TO_ERROR_STRING(STACK_POP_FROM_EMPTY);
-            break;
+            return;
+        }
 
-            case STACK_TOP_FROM_EMPTY:
-                STACK_DUMP_CAT_ERROR_NAME_TO_ERROR_STRING(STACK_TOP_FROM_EMPTY);
-            break;
+        scrubberRunning = false;
+    }
 
-            case STACK_CONSTRUCTION_FAILED:
-                STACK_DUMP_CAT_ERROR_NAME_TO_ERROR_STRING(STACK_CONSTRUCTION_FAILED);
-            break;
+    scrubberWakeUp.notify_all();
+    scrubberThread.join();
 
-            case STACK_REALLOCATION_FAILED:
-                STACK_DUMP_CAT_ERROR_NAME_TO_ERROR_STRING(STACK_REALLOCATION_FAILED);
-            break;
+    std::lock_guard<std::mutex> lock(scrubberMutex);
+    stackScrubberFreeRetired();
 
-            case STACK_NOT_CONSTRUCTED_USE:
-                STACK_DUMP_CAT_ERROR_NAME_TO_ERROR_STRING(STACK_NOT_CONSTRUCTED_USE);
-            break;
+    free(scrubberSnapshot);
+    scrubberSnapshot     = NULL;
+    scrubberSnapshotSize = 0;
+}
 
-            case STACK_DESTRUCTED_USE:
-                STACK_DUMP_CAT_ERROR_NAME_TO_ERROR_STRING(STACK_DESTRUCTED_USE);
-            break;
+#endif
 
-            case STACK_MEMORY_CORRUPTION:
-                STACK_DUMP_CAT_ERROR_NAME_TO_ERROR_STRING(STACK_MEMORY_CORRUPTION);
-            break;
-        }
+#ifdef STACK_REGISTRY_ENABLED
+
+static std::mutex registryMutex;
+static Stack*     registeredStacks      = NULL;
+static size_t     registryUsagePasses   = 0;
+static size_t     registeredStacksCount = 0;
+
+//-----------------------------------------------------------------------------
+//! Adds stack to the global registry. Called by the constructor.
+//!
+//! @param [out]  stack  
+//-----------------------------------------------------------------------------
+void stackRegistryEnroll(Stack* stack)
+{
+    assert(stack != NULL);
+
+    std::lock_guard<std::mutex> lock(registryMutex);
+
+    if (stack->registered)
+    {
+        return;
     }
-    
-    LG_WriteMessageStart(LG_COLOR_BLACK);
-    LG_Write("Stack (");
-    LG_Write(errorString, stack->errorStatus == STACK_NO_ERROR ? LG_COLOR_GREEN : LG_COLOR_RED);
 
-    if (stack->errorStatus == STACK_NOT_CONSTRUCTED_USE || stack->errorStatus == STACK_DESTRUCTED_USE)
+    stack->registryPrev = NULL;
+    stack->registryNext = registeredStacks;
+
+    if (registeredStacks != NULL)
     {
-        LG_Write(") [0x%X] \n", stack);
+        registeredStacks->registryPrev = stack;
+    }
+
+    registeredStacks  = stack;
+    stack->registered = true;
+    registeredStacksCount++;
+}
+
+//-----------------------------------------------------------------------------
+//! Removes stack from the global registry. Called by the destructor.
+//!
+//! @param [out]  stack  
+//-----------------------------------------------------------------------------
+void stackRegistryRemove(Stack* stack)
+{
+    assert(stack != NULL);
+
+    std::lock_guard<std::mutex> lock(registryMutex);
+
+    if (!stack->registered)
+    {
+        return;
+    }
+
+    if (stack->registryPrev != NULL)
+    {
+        stack->registryPrev->registryNext = stack->registryNext;
     }
     else
     {
-        LG_Write(") [0x%X] "
+        registeredStacks = stack->registryNext;
+    }
 
-                 #ifdef STACK_DEBUG_MODE
-                 "\"%s\""
-                 #endif
+    if (stack->registryNext != NULL)
+    {
+        stack->registryNext->registryPrev = stack->registryPrev;
+    }
 
-                 "\n"
-                 "{\n"  
+    stack->registryPrev = NULL;
+    stack->registryNext = NULL;
+    stack->registered   = false;
+    registeredStacksCount--;
+}
 
-                 #ifdef STACK_CANARIES_ENABLED
-                 "   canaryL: 0x%lX | must be 0x%lX\n"
-                 "   canaryR: 0x%lX | must be 0x%lX\n"
-                 #endif
+//-----------------------------------------------------------------------------
+//! Keeps stackRegistryUsage() from running until the returned lock is 
+//! released. Frozen segments are freed under it, as the usage pass reads 
+//! segments of stacks owned by other threads.
+//!
+//! @return lock of registryMutex.
+//-----------------------------------------------------------------------------
+std::unique_lock<std::mutex> stackRegistryQuiesce()
+{
+    return std::unique_lock<std::mutex>(registryMutex);
+}
 
-                 "   size         = %lu\n"
-                 "   capacity     = %lu\n"
-                 "   dynamicArray [0x%X]\n"
-                 "   {\n"
+//-----------------------------------------------------------------------------
+//! Calls visitor for every live stack.
+//!
+//! @param [in]  visitor   
+//! @param [in]  userData  passed to visitor
+//!
+//! @note visitor mustn't construct, destruct or modify stacks.
+//-----------------------------------------------------------------------------
+void stackRegistryForEach(StackVisitor visitor, void* userData)
+{
+    assert(visitor != NULL);
 
-                 #ifdef STACK_CANARIES_ENABLED
-                 "       canaryL: 0x%lX | must be 0x%lX\n"
-                 "       canaryR: 0x%lX | must be 0x%lX\n"
-                 #endif
+    std::lock_guard<std::mutex> lock(registryMutex);
 
-                 #ifdef STACK_ARRAY_HASHING
-                 "       hash:    0x%lX (decimal = %lu)\n"
-                 #endif
+    for (Stack* stack = registeredStacks; stack != NULL; stack = stack->registryNext)
+    {
+        visitor(stack, userData);
+    }
+}
 
-                 ,
-                 stack, 
+//-----------------------------------------------------------------------------
+//! Adds segment's memory to usage.
+//!
+//! @param [out]  usage    
+//! @param [in]   segment  
+//-----------------------------------------------------------------------------
+void stackAccountSegment(StackMemoryUsage* usage, const StackSegment* segment)
+{
+    #ifdef STACK_COMPRESSION_ENABLED
+    if (segment->compressed != NULL)
+    {
+        usage->totalBytes += segment->compressedSize;
+        return;
+    }
+    #endif
 
-                 #ifdef STACK_DEBUG_MODE
-                 stack->name, 
-                 #endif
+    #ifdef STACK_SPILL_ENABLED
+    if (segment->spillFile != NULL)
+    {
+        usage->totalBytes   += segment->capacity * sizeof(elem_t);
+        usage->spilledBytes += segment->capacity * sizeof(elem_t);
+        return;
+    }
+    #endif
 
-                 #ifdef STACK_CANARIES_ENABLED
-                 stack->canaryL, STACK_STRUCT_CANARY_L,
-                 stack->canaryR, STACK_STRUCT_CANARY_R,
-                 #endif
+    usage->totalBytes += arrayBlockSize(segment->capacity);
+}
 
-                 stack->size, 
-                 stack->capacity, 
-                 stack->dynamicArray
-                 
-                 #ifdef STACK_CANARIES_ENABLED
-                 ,getCanary((void*)stack->dynamicArray, stack->capacity * sizeof(elem_t), 'l'),
-                  STACK_ARRAY_CANARY_L,
-                  getCanary((void*)stack->dynamicArray, stack->capacity * sizeof(elem_t), 'r'),
-                  STACK_ARRAY_CANARY_R
-                 #endif  
+//-----------------------------------------------------------------------------
+//! Adds stack's size, capacity and memory to usage. Frozen segments are only
+//! counted by the first stack of the pass that references them. The stack 
+//! may be modified by its owner at the same time, so its fields are read with
+//! relaxed loads and segments it drops stay alive until the pass ends.
+//!
+//! @param [out]  usage  
+//! @param [in]   stack  
+//! @param [in]   pass   current stackRegistryUsage() pass
+//-----------------------------------------------------------------------------
+void stackAccountUsage(StackMemoryUsage* usage, const Stack* stack, size_t pass)
+{
+    size_t capacity = STACK_RELAXED_LOAD(stack->capacity);
 
-                 #ifdef STACK_ARRAY_HASHING
-                 ,(uint32_t*) &stack->dynamicArray[stack->capacity],
-                  (uint32_t*) &stack->dynamicArray[stack->capacity]
-                 #endif
-        );
+    usage->stacksCount++;
+    usage->totalSize     += STACK_RELAXED_LOAD(stack->frozenSize) + STACK_RELAXED_LOAD(stack->size);
+    usage->totalCapacity += capacity;
+    usage->totalBytes    += arrayBlockSize(capacity);
 
-        for (size_t i = 0; i < stack->capacity; i++)
+    // Parents of a counted segment have been counted along with it.
+    for (StackSegment* segment = STACK_RELAXED_LOAD(stack->frozen); 
+         segment != NULL && segment->usagePass != pass; 
+         segment = segment->parent)
+    {
+        segment->usagePass = pass;
+        stackAccountSegment(usage, segment);
+    }
+}
+
+//-----------------------------------------------------------------------------
+//! @return total size, capacity and memory (buffers and frozen segments) of 
+//!         all live stacks. Stacks modified meanwhile by other threads are 
+//!         counted approximately.
+//-----------------------------------------------------------------------------
+StackMemoryUsage stackRegistryUsage()
+{
+    StackMemoryUsage usage = {};
+
+    std::lock_guard<std::mutex> lock(registryMutex);
+
+    size_t pass = ++registryUsagePasses;
+
+    for (Stack* stack = registeredStacks; stack != NULL; stack = stack->registryNext)
+    {
+        stackAccountUsage(&usage, stack, pass);
+    }
+
+    return usage;
+}
+
+#ifdef STACK_DEBUG_MODE
+//-----------------------------------------------------------------------------
+//! @param [in]  name  
+//!
+//! @return total size, capacity and memory of all live stacks named name.
+//-----------------------------------------------------------------------------
+StackMemoryUsage stackRegistryUsage(const char* name)
+{
+    assert(name != NULL);
+
+    StackMemoryUsage usage = {};
+
+    std::lock_guard<std::mutex> lock(registryMutex);
+
+    size_t pass = ++registryUsagePasses;
+
+    for (Stack* stack = registeredStacks; stack != NULL; stack = stack->registryNext)
+    {
+        if (stack->name != NULL && strcmp(stack->name, name) == 0)
         {
-            if (i < stack->size)
+            stackAccountUsage(&usage, stack, pass);
+        }
+    }
+
+    return usage;
+}
+#endif
+
+//-----------------------------------------------------------------------------
+//! Fully verifies stacks [begin, end) without modifying them.
+//!
+//! @param [in]   stacks  
+//! @param [out]  errors  error found in each stack or STACK_NO_ERROR
+//! @param [in]   begin  
+//! @param [in]   end  
+//-----------------------------------------------------------------------------
+void stackAuditRange(Stack* const* stacks, StackErrors* errors, size_t begin, size_t end)
+{
+    for (size_t i = begin; i < end; i++)
+    {
+        errors[i] = stacks[i]->errorStatus;
+
+        #ifdef STACK_SCRUBBER_ENABLED
+        if (errors[i] == STACK_NO_ERROR)
+        {
+            errors[i] = stacks[i]->scrubError.load(std::memory_order_acquire);
+        }
+        #endif
+
+        if (errors[i] == STACK_NO_ERROR)
+        {
+            errors[i] = stackFindError(stacks[i], true, true);
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+//! Fully verifies every live stack, including full buffer scans of scrubbed
+//! ones, and dumps the ones that are broken. The stacks themselves are left 
+//! untouched, their owners find the errors on their own checks. Stacks 
+//! mustn't be modified during the audit.
+//!
+//! @param [in]  parallel  whether or not to split verification between 
+//!                        hardware threads, the calling thread does the 
+//!                        work of threads that can't be created
+//!
+//! @return number of broken stacks or SIZE_MAX if memory for the audit 
+//!         couldn't be allocated.
+//-----------------------------------------------------------------------------
+size_t stackAuditAll(bool parallel)
+{
+    std::lock_guard<std::mutex> lock(registryMutex);
+
+    if (registeredStacksCount == 0)
+    {
+        return 0;
+    }
+
+    Stack**      stacks = (Stack**)      calloc(registeredStacksCount, sizeof(Stack*));
+    StackErrors* errors = (StackErrors*) calloc(registeredStacksCount, sizeof(StackErrors));
+
+    if (stacks == NULL || errors == NULL)
+    {
+        free(stacks);
+        free(errors);
+        return SIZE_MAX;
+    }
+
+    size_t count = 0;
+    for (Stack* stack = registeredStacks; stack != NULL; stack = stack->registryNext)
+    {
+        stacks[count++] = stack;
+    }
+
+    size_t threadsCount = parallel ? std::thread::hardware_concurrency() : 1;
+    if (threadsCount > count)
+    {
+        threadsCount = count;
+    }
+
+    std::thread* threads = NULL;
+
+    if (threadsCount > 1)
+    {
+        threads = new (std::nothrow) std::thread[threadsCount - 1];
+    }
+
+    if (threads == NULL)
+    {
+        stackAuditRange(stacks, errors, 0, count);
+    }
+    else
+    {
+        size_t chunkSize = (count + threadsCount - 1) / threadsCount;
+
+        for (size_t i = 0; i < threadsCount - 1; i++)
+        {
+            size_t end = (i + 1) * chunkSize < count ? (i + 1) * chunkSize : count;
+
+            try
             {
-                LG_Write("       *[%lu]\t= %lg ", 
-                         i, stack->dynamicArray[i]);
+                threads[i] = std::thread(stackAuditRange, stacks, errors, i * chunkSize, end);
             }
-            else
+            catch (const std::system_error&)
             {
-                LG_Write("        [%lu]\t= %lg ", 
-                         i, stack->dynamicArray[i]);
+                stackAuditRange(stacks, errors, i * chunkSize, end);
             }
+        }
 
-            #ifdef STACK_POISON
-            if (IS_STACK_POISON(stack->dynamicArray[i]))
+        stackAuditRange(stacks, errors, (threadsCount - 1) * chunkSize, count);
+
+        for (size_t i = 0; i < threadsCount - 1; i++)
+        {
+            if (threads[i].joinable())
             {
-                LG_Write("(POISON!)");
+                threads[i].join();
             }
-            #endif
-
-            LG_Write("\n");
         }
 
-        LG_Write("   }\n"
-                 "}\n");
-
+        delete[] threads;
     }
 
-    LG_WriteMessageEnd();
-
-    if (stack->errorStatus != STACK_NO_ERROR)
+    size_t failedCount = 0;
+    for (size_t i = 0; i < count; i++)
     {
-        LG_Close();
+        if (errors[i] != STACK_NO_ERROR)
+        {
+            failedCount++;
+            dumpStack(stacks[i], errors[i]);
+        }
     }
-}
\ No newline at end of file
+
+    free(stacks);
+    free(errors);
+
+    return failedCount;
+}
+
+#endif
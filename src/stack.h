@@ -5,24 +5,61 @@
 #include <stdint.h>
 #include <stdio.h>
 
+#include <iterator>
+
+#ifdef STACK_SCRUBBER_ENABLED
+#include <atomic>
+#endif
+
 #ifdef STACK_DEBUG_MODE
 #define STACK_DEBUG_LVL3 
 #endif
 
+#if defined(__GNUC__)
+#define STACK_LIKELY(condition)   __builtin_expect(!!(condition), 1)
+#define STACK_UNLIKELY(condition) __builtin_expect(!!(condition), 0)
+#define STACK_COLD                __attribute__((cold, noinline))
+#else
+#define STACK_LIKELY(condition)   (condition)
+#define STACK_UNLIKELY(condition) (condition)
+#define STACK_COLD
+#endif
+
+//-----------------------------------------------------------------------------
+//! ASSERT_STACK_OK_OR_RETURN is the variant used in functions returning a 
+//! value. By default a failed check aborts in stackReportError. With 
+//! STACK_NON_FATAL_ERRORS the calling function returns instead, leaving the 
+//! error in stack's errorStatus until stackClearError() is called.
+//-----------------------------------------------------------------------------
 #if !defined(STACK_DEBUG_LVL1) && !defined(STACK_DEBUG_LVL2) && !defined(STACK_DEBUG_LVL3)
-#define ASSERT_STACK_OK(stack) assert(stack != NULL);
+#define STACK_FAILED(stack) (stack == NULL || stack->errorStatus != STACK_NO_ERROR)
+
+#ifdef STACK_NON_FATAL_ERRORS
+#define ASSERT_STACK_OK(stack)                        if (STACK_UNLIKELY(STACK_FAILED(stack))) { stackReportError(stack); return; }
+#define ASSERT_STACK_OK_OR_RETURN(stack, returnValue) if (STACK_UNLIKELY(STACK_FAILED(stack))) { stackReportError(stack); return returnValue; }
+#else
+#define ASSERT_STACK_OK(stack)                        assert(stack != NULL);
+#define ASSERT_STACK_OK_OR_RETURN(stack, returnValue) assert(stack != NULL);
+#endif
 #else
 #define STACK_DEBUG_MODE
+#define STACK_FAILED(stack) (stack == NULL || !stackOk(stack))
+
+#ifdef STACK_NON_FATAL_ERRORS
+#define ASSERT_STACK_OK(stack)                        if (STACK_UNLIKELY(STACK_FAILED(stack))) { stackReportError(stack); return; }
+#define ASSERT_STACK_OK_OR_RETURN(stack, returnValue) if (STACK_UNLIKELY(STACK_FAILED(stack))) { stackReportError(stack); return returnValue; }
+#else
+#define ASSERT_STACK_OK(stack)                        if (STACK_UNLIKELY(STACK_FAILED(stack))) { stackReportError(stack); }
+#define ASSERT_STACK_OK_OR_RETURN(stack, returnValue) if (STACK_UNLIKELY(STACK_FAILED(stack))) { stackReportError(stack); }
+#endif
 #endif
 
 #ifdef STACK_DEBUG_LVL1
-#define ASSERT_STACK_OK(stack) if(stack == NULL || !stackOk(stack)) { dump(stack); assert(! "OK"); }
 #define STACK_POISON           nan("")
 #define IS_STACK_POISON(value) isnan(value)
 #endif
 
 #ifdef STACK_DEBUG_LVL2
-#define ASSERT_STACK_OK(stack) if(stack == NULL || !stackOk(stack)) { dump(stack); assert(! "OK"); }
 #define STACK_POISON           nan("")
 #define IS_STACK_POISON(value) isnan(value)
 
@@ -30,7 +67,6 @@
 #endif
 
 #ifdef STACK_DEBUG_LVL3
-#define ASSERT_STACK_OK(stack) if(stack == NULL || !stackOk(stack)) { dump(stack); assert(! "OK"); }
 #define STACK_POISON           nan("")
 #define IS_STACK_POISON(value) isnan(value)
 #define STACK_CANARIES_ENABLED
@@ -38,6 +74,13 @@
 #define STACK_ARRAY_HASHING
 #endif
 
+// Without protection the common cases of stackPush, stackPop, stackTop and 
+// stackSize need no checks and are inlined, everything else goes to the 
+// library's fstack* functions.
+#ifndef STACK_DEBUG_MODE
+#define STACK_INLINE_FAST_PATH
+#endif
+
 #ifdef STACK_CANARIES_ENABLED
 static uint32_t STACK_ARRAY_CANARY_L  = 0xBADC0FFE;
 static uint32_t STACK_ARRAY_CANARY_R  = 0xDEADBEEF;
@@ -49,9 +92,13 @@ static uint32_t STACK_STRUCT_CANARY_R = 0xFACEBEEF;
 #ifdef STACK_DEBUG_MODE
 #define stackConstruct(stack, capacity) fstackConstruct(stack, capacity, &#stack[1]);
 #define stackDefaultConstruct(stack)    fstackConstruct(stack, &#stack[1]);
+
+#define recordStackConstruct(stack, capacity) frecordStackConstruct(stack, capacity, &#stack[1]);
 #else
 #define stackConstruct(stack, capacity) fstackConstruct(stack, capacity);
 #define stackDefaultConstruct(stack)    fstackConstruct(stack);
+
+#define recordStackConstruct(stack, capacity) frecordStackConstruct(stack, capacity);
 #endif
 
 typedef double elem_t;
@@ -60,6 +107,8 @@ static double STACK_EXPAND_MULTIPLIER = 1.8;
 static size_t DEFAULT_STACK_CAPACITY  = 10;
 static size_t MINIMAL_STACK_CAPACITY  = 3;
 
+static size_t MINIMAL_RECORD_STACK_CAPACITY = 64; // bytes
+
 #ifdef STACK_DEBUG_MODE
 static const char* DYNAMICALLY_CREATED_STACK_NAME  = "no name, created dynamically";
 #endif
@@ -73,9 +122,69 @@ enum StackErrors
     STACK_REALLOCATION_FAILED,
     STACK_NOT_CONSTRUCTED_USE,
     STACK_DESTRUCTED_USE,
-    STACK_MEMORY_CORRUPTION
+    STACK_MEMORY_CORRUPTION,
+    STACK_MODIFIED_WHILE_VIEWED,
+    STACK_INVALID_MARK,
+    STACK_NOT_ENOUGH_OPERANDS,
+    STACK_SPILL_FAILED,
+    STACK_VIEW_OF_FROZEN,
+    STACK_DOMAIN_ERROR
+};
+
+enum StackOperation
+{
+    // Binary operations replace two top elements (second, top) with 
+    // (second OP top)
+    STACK_OP_ADD,
+    STACK_OP_SUB,
+    STACK_OP_MUL,
+    STACK_OP_DIV,
+    STACK_OP_MIN,
+    STACK_OP_MAX,
+
+    // Unary operations replace top element with OP(top)
+    STACK_OP_NEG,
+    STACK_OP_ABS,
+    STACK_OP_SQRT
+};
+
+enum StackReduction
+{
+    STACK_REDUCE_SUM,
+    STACK_REDUCE_MIN,
+    STACK_REDUCE_MAX,
+    STACK_REDUCE_MEAN,
+    STACK_REDUCE_NAN_COUNT
+};
+
+#ifdef STACK_HUGE_PAGES_ENABLED
+enum StackPagePolicy
+{
+    STACK_PAGES_DEFAULT,
+    STACK_PAGES_TRANSPARENT_HUGE, // madvise(MADV_HUGEPAGE)
+    STACK_PAGES_EXPLICIT_HUGE     // MAP_HUGETLB, transparent ones if none are reserved
+};
+
+enum StackNumaPolicy
+{
+    STACK_NUMA_DEFAULT,
+    STACK_NUMA_BIND,
+    STACK_NUMA_INTERLEAVE
 };
 
+static size_t DEFAULT_STACK_HUGE_PAGE_THRESHOLD = 2 << 20;
+
+// Applies only to buffers of at least threshold bytes, smaller ones are 
+// always allocated with calloc/realloc.
+struct StackMemoryPolicy
+{
+    StackPagePolicy pages     = STACK_PAGES_DEFAULT;
+    StackNumaPolicy numa      = STACK_NUMA_DEFAULT;
+    unsigned long   numaNodes = 0; // bit mask of nodes for numa
+    size_t          threshold = DEFAULT_STACK_HUGE_PAGE_THRESHOLD;
+};
+#endif
+
 enum StackStatus
 {
     STACK_STATUS_NOT_CONSTRUCTED,
@@ -83,6 +192,74 @@ enum StackStatus
     STACK_STATUS_DESTRUCTED
 };
 
+#ifdef STACK_SPILL_ENABLED
+struct StackSpillFile;
+#endif
+
+struct StackSegment
+{
+    size_t        refCount     = 0;
+    StackSegment* parent       = NULL;
+    size_t        parentSize   = 0;
+    elem_t*       dynamicArray = NULL;
+    size_t        size         = 0;
+    size_t        capacity     = 0;
+
+    #ifdef STACK_COMPRESSION_ENABLED
+    // Compressed segments have no dynamicArray, their elements are XOR
+    // encoded in compressed instead.
+    uint8_t*      compressed     = NULL;
+    size_t        compressedSize = 0;
+    uint32_t      compressedHash = 0;
+    // Memory taken by the blocks stackCompressCold() made of this and parent
+    // segments, counted against the stack's memory budget.
+    size_t        coldBytes      = 0;
+    #endif
+    #ifdef STACK_SPILL_ENABLED
+    // Spilled segments have no dynamicArray, their elements are stored in 
+    // spillFile at spillOffset instead.
+    StackSpillFile* spillFile     = NULL;
+    size_t          spillOffset   = 0;
+    uint32_t        spillChecksum = 0;
+    #endif
+    #ifdef STACK_REGISTRY_ENABLED
+    // Last stackRegistryUsage() pass that counted this segment, so that 
+    // segments shared by several stacks are counted once.
+    size_t          usagePass     = 0;
+    #endif
+};
+
+#ifdef STACK_AGGREGATES_ENABLED
+enum StackAggregateTrack
+{
+    STACK_TRACK_MIN,
+    STACK_TRACK_MAX,
+    STACK_TRACK_SUM,
+    STACK_TRACK_COMPENSATION, // of the sum, see stackSum()
+    STACK_TRACKS_COUNT
+};
+
+// Prefix aggregates of the stack's elements: entry i of every track covers 
+// dynamicArray[0..i]. Only the first size entries are up to date, the rest 
+// are poisoned like the unused part of dynamicArray.
+struct StackAggregates
+{
+    elem_t* tracks[STACK_TRACKS_COUNT] = {};
+    size_t  size                       = 0;
+    size_t  capacity                   = 0;
+};
+#endif
+
+struct Stack;
+
+struct StackMark
+{
+    const Stack* stack  = NULL;
+    size_t       depth  = 0;
+    size_t       index  = 0;
+    size_t       serial = 0;
+};
+
 struct Stack
 {
     #ifdef STACK_CANARIES_ENABLED
@@ -93,11 +270,99 @@ struct Stack
     const char* name = NULL;
     #endif
 
-    size_t       size         = 0;
-    size_t       capacity     = 0;
-    elem_t*      dynamicArray = NULL;
-    StackStatus  status       = STACK_STATUS_NOT_CONSTRUCTED;
-    StackErrors  errorStatus  = STACK_NO_ERROR;
+    size_t        size          = 0;
+    size_t        capacity      = 0;
+    elem_t*       dynamicArray  = NULL;
+    StackSegment* frozen        = NULL;
+    size_t        frozenSize    = 0;
+    StackMark*    marks         = NULL;
+    size_t        marksCount    = 0;
+    size_t        marksCapacity = 0;
+    size_t        marksSerial   = 0;
+    StackStatus   status        = STACK_STATUS_NOT_CONSTRUCTED;
+    StackErrors   errorStatus   = STACK_NO_ERROR;
+
+    #ifdef STACK_HUGE_PAGES_ENABLED
+    StackMemoryPolicy memoryPolicy;
+    #endif
+
+    #ifdef STACK_COMPRESSION_ENABLED
+    size_t compressionBlock = 0;
+    #endif
+
+    #ifdef STACK_SPILL_ENABLED
+    size_t          memoryBudget   = 0;
+    StackSpillFile* spillFile      = NULL;
+    size_t          spillReadahead = 0;
+    #endif
+
+    #ifdef STACK_AGGREGATES_ENABLED
+    StackAggregates aggregates;
+    #endif
+
+    #ifdef STACK_DEBUG_MODE
+    uint32_t modificationCount = 0;
+    #endif
+
+    #ifdef STACK_SCRUBBER_ENABLED
+    std::atomic<uint32_t>    sequence      {0};
+    std::atomic<StackErrors> scrubError    {STACK_NO_ERROR}; // taken over by stackOk()
+    bool                     scrubbed      = false;
+    Stack*                   scrubPrev     = NULL;
+    Stack*                   scrubNext     = NULL;
+
+    // dynamicArray's hash as of sequence scrubSequence, kept by the scrubber
+    // instead of the one stored after the array
+    bool                     scrubHashed   = false;
+    uint32_t                 scrubHash     = 0;
+    uint32_t                 scrubSequence = 0;
+    #endif
+
+    #ifdef STACK_REGISTRY_ENABLED
+    bool   registered   = false;
+    Stack* registryPrev = NULL;
+    Stack* registryNext = NULL;
+    #endif
+
+    #ifdef STACK_CANARIES_ENABLED
+    uint32_t canaryR = STACK_STRUCT_CANARY_R;
+    #endif
+};
+
+struct StackView
+{
+    const elem_t* data = NULL;
+    size_t        size = 0;
+
+    #ifdef STACK_DEBUG_MODE
+    Stack*   stack             = NULL;
+    uint32_t modificationCount = 0;
+    #endif
+};
+
+typedef std::reverse_iterator<const elem_t*> StackViewReverseIterator;
+
+// Records are stored in arena one after another as [length][payload][length], 
+// with the payload padded to RECORD_STACK_ALIGNMENT, so that pop only needs 
+// to read the length in front of size. size and capacity are in bytes.
+static const size_t RECORD_STACK_ALIGNMENT = sizeof(size_t);
+
+struct RecordStack
+{
+    #ifdef STACK_CANARIES_ENABLED
+    uint32_t canaryL = STACK_STRUCT_CANARY_L;
+    #endif
+
+    #ifdef STACK_DEBUG_MODE
+    const char* name = NULL;
+    #endif
+
+    size_t      size         = 0;
+    size_t      capacity     = 0;
+    size_t      recordsCount = 0;
+    uint8_t*    arena        = NULL;
+    StackStatus status       = STACK_STATUS_NOT_CONSTRUCTED;
+    StackErrors errorStatus  = STACK_NO_ERROR;
 
     #ifdef STACK_CANARIES_ENABLED
     uint32_t canaryR = STACK_STRUCT_CANARY_R;
@@ -116,17 +381,279 @@ Stack*       newStack         (size_t capacity);
 Stack*       newStack         ();
 void         stackDestruct    (Stack* stack);
 void         deleteStack      (Stack* stack);
-size_t       stackSize        (Stack* stack);
+size_t       fstackSize       (Stack* stack);
 size_t       stackCapacity    (Stack* stack);
 StackErrors  stackErrorStatus (Stack* stack);
+bool         stackClearError  (Stack* stack);
                               
-StackErrors  stackPush        (Stack* stack, elem_t value);
-elem_t       stackPop         (Stack* stack);
-elem_t       stackTop         (Stack* stack);
+StackErrors  fstackPush       (Stack* stack, elem_t value);
+elem_t       fstackPop        (Stack* stack);
+elem_t       fstackTop        (Stack* stack);
 void         stackClear       (Stack* stack);
 bool         stackShrinkToFit (Stack* stack);
+void         stackSwap        (Stack* first, Stack* second);
+StackErrors  stackMove        (Stack* destination, Stack* source);
+StackErrors  stackSplice      (Stack* destination, Stack* source);
+StackErrors  stackFork        (Stack* destination, Stack* source);
+StackMark    stackMark        (Stack* stack);
+StackErrors  stackRollback    (Stack* stack, StackMark mark);
+
+StackErrors  stackApplyBinary (Stack* stack, StackOperation operation);
+StackErrors  stackApplyUnary  (Stack* stack, StackOperation operation);
+StackErrors  stackEvaluate    (Stack* stack, const StackOperation* operations, size_t count);
+
+elem_t       stackReduce      (Stack* stack, StackReduction reduction);
+StackErrors  stackTransform   (Stack* stack, elem_t scale, elem_t offset);
+
+StackView                stackView        (Stack* stack);
+bool                     stackViewValid   (const StackView* view);
+const elem_t*            stackViewBegin   (const StackView* view);
+const elem_t*            stackViewEnd     (const StackView* view);
+StackViewReverseIterator stackViewRBegin  (const StackView* view);
+StackViewReverseIterator stackViewREnd    (const StackView* view);
+elem_t                   stackViewAt      (const StackView* view, size_t index);
+elem_t                   stackViewFromTop (const StackView* view, size_t index);
 
 bool         stackOk          (Stack* stack);    
+bool         stackAudit       (Stack* stack);
 void         dump             (Stack* stack);
+STACK_COLD
+void         stackReportError (Stack* stack);
+
+//-----------------------------------------------------------------------------
+//! @param [in]  stack   
+//!
+//! @return whether or not stack can be modified without going through the 
+//!         library, i.e. it has no pending error and isn't scrubbed.
+//-----------------------------------------------------------------------------
+inline bool stackFastPathReady(const Stack* stack)
+{
+    assert(stack != NULL);
+
+    #ifdef STACK_NON_FATAL_ERRORS
+    if (stack->errorStatus != STACK_NO_ERROR)
+    {
+        return false;
+    }
+    #endif
+
+    #ifdef STACK_SCRUBBER_ENABLED
+    if (stack->scrubbed)
+    {
+        return false;
+    }
+    #endif
+
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+//! @param [in]  stack   
+//!
+//! @return whether or not a value can be pushed to stack without going 
+//!         through the library, i.e. without growth (or aggregates to 
+//!         maintain).
+//-----------------------------------------------------------------------------
+inline bool stackFastPushReady(const Stack* stack)
+{
+    #ifdef STACK_AGGREGATES_ENABLED
+    if (stack->aggregates.tracks[0] != NULL)
+    {
+        return false;
+    }
+    #endif
+
+    return stack->size < stack->capacity;
+}
+
+//-----------------------------------------------------------------------------
+//! @param [in]  stack   
+//!
+//! @return whether or not stack's top element can be popped without going 
+//!         through the library, i.e. it is in the stack's own array and 
+//!         there are no marks to drop (or spilled elements to read ahead or
+//!         aggregates to maintain).
+//-----------------------------------------------------------------------------
+inline bool stackFastPopReady(const Stack* stack)
+{
+    if (stack->size == 0)
+    {
+        return false;
+    }
+
+    #ifdef STACK_AGGREGATES_ENABLED
+    if (stack->aggregates.tracks[0] != NULL)
+    {
+        return false;
+    }
+    #endif
+
+    #ifdef STACK_SPILL_ENABLED
+    if (stack->size <= stack->spillReadahead)
+    {
+        return false;
+    }
+    #endif
+
+    return stack->marksCount == 0 || 
+           stack->marks[stack->marksCount - 1].depth < stack->frozenSize + stack->size;
+}
+
+//-----------------------------------------------------------------------------
+//! Push value to stack. Pushing without growth (or aggregates to maintain) is
+//! inlined, see fstackPush().
+//!
+//! @param [out]  stack   
+//! @param [in]   value   
+//!
+//! @return NO_ERROR if pushed successfully or some STACK_ERRORS code 
+//!         otherwise.
+//-----------------------------------------------------------------------------
+inline StackErrors stackPush(Stack* stack, elem_t value)
+{
+    #ifdef STACK_INLINE_FAST_PATH
+    if (STACK_LIKELY(stackFastPathReady(stack) && stackFastPushReady(stack)))
+    {
+        stack->dynamicArray[stack->size++] = value;
+        return STACK_NO_ERROR;
+    }
+    #endif
+
+    return fstackPush(stack, value);
+}
+
+//-----------------------------------------------------------------------------
+//! Removes the element on top of the stack and returns it. Popping from the 
+//! stack's own array with no mark to drop (and no spilled elements to read
+//! ahead or aggregates to maintain) is inlined, see fstackPop().
+//!
+//! @param [out]  stack    
+//!
+//! @return the element on top of the stack.
+//-----------------------------------------------------------------------------
+inline elem_t stackPop(Stack* stack)
+{
+    #ifdef STACK_INLINE_FAST_PATH
+    if (STACK_LIKELY(stackFastPathReady(stack) && stackFastPopReady(stack)))
+    {
+        return stack->dynamicArray[--stack->size];
+    }
+    #endif
+
+    return fstackPop(stack);
+}
+
+//-----------------------------------------------------------------------------
+//! Returns the element on top of the stack, see fstackTop().
+//!
+//! @param [out]  stack    
+//!
+//! @return the element on top of the stack.
+//-----------------------------------------------------------------------------
+inline elem_t stackTop(Stack* stack)
+{
+    #ifdef STACK_INLINE_FAST_PATH
+    if (STACK_LIKELY(stackFastPathReady(stack) && stack->size > 0))
+    {
+        return stack->dynamicArray[stack->size - 1];
+    }
+    #endif
+
+    return fstackTop(stack);
+}
+
+//-----------------------------------------------------------------------------
+//! @param [in]  stack   
+//!
+//! @return current size of stack.
+//-----------------------------------------------------------------------------
+inline size_t stackSize(Stack* stack)
+{
+    #ifdef STACK_INLINE_FAST_PATH
+    if (STACK_LIKELY(stackFastPathReady(stack)))
+    {
+        return stack->frozenSize + stack->size;
+    }
+    #endif
+
+    return fstackSize(stack);
+}
+
+#ifdef STACK_HUGE_PAGES_ENABLED
+StackErrors  stackSetMemoryPolicy (Stack* stack, const StackMemoryPolicy* policy);
+#endif
+
+#ifdef STACK_COMPRESSION_ENABLED
+StackErrors  stackSetCompression  (Stack* stack, size_t blockSize);
+#endif
+
+#ifdef STACK_SPILL_ENABLED
+StackErrors  stackSetMemoryBudget (Stack* stack, size_t budget);
+#endif
+
+#ifdef STACK_AGGREGATES_ENABLED
+StackErrors  stackSetAggregates   (Stack* stack, bool enabled);
+elem_t       stackMin             (Stack* stack);
+elem_t       stackMax             (Stack* stack);
+elem_t       stackSum             (Stack* stack);
+#endif
+
+#ifdef STACK_DEBUG_MODE
+RecordStack* frecordStackConstruct (RecordStack* stack, size_t capacity, const char* stackName);
+#else
+RecordStack* frecordStackConstruct (RecordStack* stack, size_t capacity);
+#endif
+
+void         recordStackDestruct   (RecordStack* stack);
+size_t       recordStackSize       (RecordStack* stack);
+size_t       recordStackBytes      (RecordStack* stack);
+StackErrors  recordStackPush       (RecordStack* stack, const void* record, size_t length);
+const void*  recordStackTop        (RecordStack* stack, size_t* length);
+StackErrors  recordStackPop        (RecordStack* stack);
+StackErrors  recordStackRelease    (RecordStack* stack, size_t count);
+void         recordStackClear      (RecordStack* stack);
+StackErrors  stackErrorStatus      (RecordStack* stack);
+bool         stackClearError       (RecordStack* stack);
+
+bool         stackOk               (RecordStack* stack);
+void         dump                  (RecordStack* stack);
+STACK_COLD
+void         stackReportError      (RecordStack* stack);
+
+#ifdef STACK_SCRUBBER_ENABLED
+// Called on the scrubber thread after the scrub pass, so it mustn't access the
+// stack, which may be in use by its owner or already gone. The error is also 
+// taken over by the owner's next stackOk() or stackErrorStatus().
+typedef void (*StackCorruptionCallback)(Stack* stack, StackErrors error, void* userData);
+
+static unsigned DEFAULT_STACK_SCRUB_PERIOD_MS = 100;
+static unsigned STACK_SCRUB_MAX_ATTEMPTS      = 4;
+
+bool         stackScrubberStart      (unsigned periodMs, StackCorruptionCallback callback, void* userData);
+void         stackScrubberStop       ();
+void         stackScrubberRegister   (Stack* stack);
+void         stackScrubberUnregister (Stack* stack);
+size_t       stackScrubberRunPass    ();
+#endif
+
+#ifdef STACK_REGISTRY_ENABLED
+struct StackMemoryUsage
+{
+    size_t stacksCount   = 0;
+    size_t totalSize     = 0;
+    size_t totalCapacity = 0;
+    size_t totalBytes    = 0; // including spilledBytes
+    size_t spilledBytes  = 0;
+};
+
+typedef void (*StackVisitor)(Stack* stack, void* userData);
+
+void             stackRegistryForEach (StackVisitor visitor, void* userData);
+StackMemoryUsage stackRegistryUsage   ();
+#ifdef STACK_DEBUG_MODE
+StackMemoryUsage stackRegistryUsage   (const char* name);
+#endif
+size_t           stackAuditAll        (bool parallel);
+#endif
 
 #endif
\ No newline at end of file
@@ -1,11 +1,893 @@
+#include <math.h>
+#include <string.h>
 #include "stack.h"
 
+//-----------------------------------------------------------------------------
+//! Pushes values [from, to) to stack.
+//-----------------------------------------------------------------------------
+void pushRange(Stack* stack, int from, int to)
+{
+    for (int value = from; value < to; value++)
+    {
+        stackPush(stack, value);
+    }
+}
+
+//-----------------------------------------------------------------------------
+//! Pops values (to, from] from stack and checks that they are what
+//! pushRange(stack, from, to) pushed.
+//-----------------------------------------------------------------------------
+void popRange(Stack* stack, int from, int to)
+{
+    for (int value = to - 1; value >= from; value--)
+    {
+        assert(stackPop(stack) == value);
+    }
+}
+
+//-----------------------------------------------------------------------------
+//! Checks that a fork and its source don't see each other's changes.
+//-----------------------------------------------------------------------------
+void testFork()
+{
+    Stack stack = {};
+    Stack fork  = {};
+    stackConstruct(&stack, 16);
+    stackConstruct(&fork,  16);
+
+    pushRange(&stack, 0, 100);
+
+    #ifdef STACK_REGISTRY_ENABLED
+    StackMemoryUsage usageBefore = stackRegistryUsage();
+    #endif
+
+    assert(stackFork(&fork, &stack) == STACK_NO_ERROR);
+
+    #ifdef STACK_REGISTRY_ENABLED
+    // The shared segment is counted, but only once.
+    StackMemoryUsage usage = stackRegistryUsage();
+    assert(usage.totalSize  == 200);
+    assert(usage.totalBytes >= 100 * sizeof(elem_t));
+    assert(usage.totalBytes -  usageBefore.totalBytes < 100 * sizeof(elem_t));
+    #endif
+
+    #ifdef STACK_ARRAY_HASHING
+    // Segments are only scanned by full audits
+    if (fork.frozen->dynamicArray != NULL)
+    {
+        elem_t frozenValue = fork.frozen->dynamicArray[0];
+        fork.frozen->dynamicArray[0] = -1;
+
+        assert(stackOk(&fork));
+        assert(!stackAudit(&fork));
+        assert(fork.errorStatus == STACK_MEMORY_CORRUPTION);
+
+        fork.frozen->dynamicArray[0] = frozenValue;
+        fork.errorStatus = STACK_NO_ERROR;
+        assert(stackAudit(&fork));
+    }
+    #endif
+
+    popRange (&fork,  50, 100);
+    pushRange(&fork,  1000, 1010);
+    pushRange(&stack, 100, 120);
+
+    popRange(&stack, 0, 120);
+    assert(stackSize(&stack) == 0);
+
+    popRange(&fork, 1000, 1010);
+    popRange(&fork, 0, 50);
+    assert(stackSize(&fork) == 0);
+
+    stackDestruct(&fork);
+    stackDestruct(&stack);
+}
+
+//-----------------------------------------------------------------------------
+//! Checks that rollback unwinds to a mark and rejects stale and foreign ones.
+//-----------------------------------------------------------------------------
+void testRollback()
+{
+    Stack stack = {};
+    Stack other = {};
+    stackConstruct(&stack, 16);
+    stackConstruct(&other, 16);
+
+    pushRange(&stack, 0, 10);
+    pushRange(&other, 0, 10);
+
+    StackMark first = stackMark(&stack);
+    StackMark alien = stackMark(&other);
+
+    // Invalid marks are only reported back when the check doesn't abort.
+    #if defined(STACK_NON_FATAL_ERRORS) || !defined(STACK_DEBUG_MODE)
+    #define TEST_INVALID_MARKS
+    #endif
+
+    pushRange(&stack, 10, 20);
+    #ifdef TEST_INVALID_MARKS
+    StackMark second = stackMark(&stack);
+    #endif
+    pushRange(&stack, 20, 30);
+
+    assert(stackRollback(&stack, first) == STACK_NO_ERROR);
+    assert(stackSize(&stack) == 10);
+
+    #ifdef TEST_INVALID_MARKS
+    assert(stackRollback(&stack, second) == STACK_INVALID_MARK);
+    assert(stackClearError(&stack));
+
+    assert(stackRollback(&stack, alien) == STACK_INVALID_MARK);
+    assert(stackClearError(&stack));
+    #endif
+
+    pushRange(&stack, 10, 15);
+    assert(stackRollback(&stack, first) == STACK_NO_ERROR);
+    popRange(&stack, 0, 10);
+
+    assert(stackRollback(&other, alien) == STACK_NO_ERROR);
+    popRange(&other, 0, 10);
+
+    stackDestruct(&other);
+    stackDestruct(&stack);
+}
+
+//-----------------------------------------------------------------------------
+//! Checks that swap, move and splice carry elements over (frozen ones too) 
+//! and drop marks that no longer match the contents.
+//-----------------------------------------------------------------------------
+void testTransfers()
+{
+    Stack first  = {};
+    Stack second = {};
+    Stack third  = {};
+    stackConstruct(&first,  16);
+    stackConstruct(&second, 16);
+    stackConstruct(&third,  16);
+
+    pushRange(&first,  0, 5);
+    pushRange(&second, 5, 100);
+
+    StackMark swapped = stackMark(&first);
+
+    stackSwap(&first, &second);
+    assert(stackSize(&first) == 95 && stackSize(&second) == 5);
+
+    assert(stackMove(&third, &first) == STACK_NO_ERROR);
+    assert(stackSize(&first) == 0 && stackSize(&third) == 95);
+
+    // Source's buffer is larger and fits both stacks, so it is reused
+    size_t thirdCapacity = third.capacity;
+    assert(stackSplice(&second, &third) == STACK_NO_ERROR);
+    assert(stackSize(&second) == 100 && stackSize(&third) == 0);
+    assert(second.capacity == thirdCapacity);
+
+    // Source's frozen elements are copied, its fork keeps sharing them
+    pushRange(&first, -5, 0);
+    assert(stackFork(&third, &second) == STACK_NO_ERROR);
+
+    StackMark kept    = stackMark(&first);
+    StackMark spliced = stackMark(&third);
+
+    assert(stackSplice(&first, &third) == STACK_NO_ERROR);
+    assert(stackSize(&first) == 105 && stackSize(&third) == 0);
+
+    popRange(&first, 50, 100);
+    assert(stackRollback(&first, kept) == STACK_NO_ERROR);
+    popRange(&first, -5, 0);
+
+    // An empty destination takes source's frozen elements as they are
+    assert(stackSplice(&third, &second) == STACK_NO_ERROR);
+    assert(stackSize(&third) == 100 && stackSize(&second) == 0);
+    assert(third.frozen != NULL);
+    popRange(&third, 0, 100);
+
+    #if defined(STACK_NON_FATAL_ERRORS) || !defined(STACK_DEBUG_MODE)
+    assert(stackRollback(&second, swapped) == STACK_INVALID_MARK);
+    assert(stackClearError(&second));
+
+    assert(stackRollback(&third, spliced) == STACK_INVALID_MARK);
+    assert(stackClearError(&third));
+    #else
+    (void) swapped;
+    (void) spliced;
+    #endif
+
+    stackDestruct(&third);
+    stackDestruct(&second);
+    stackDestruct(&first);
+}
+
+//-----------------------------------------------------------------------------
+//! Checks that a view reads stack's elements both ways and that views of 
+//! stacks with frozen elements and of modified stacks are refused.
+//-----------------------------------------------------------------------------
+void testView()
+{
+    Stack stack = {};
+    Stack fork  = {};
+    stackConstruct(&stack, 16);
+    stackConstruct(&fork,  16);
+
+    pushRange(&stack, 0, 100);
+
+    StackView view = stackView(&stack);
+    assert(stackViewValid(&view));
+    assert(view.size == 100);
+    assert(stackViewAt(&view, 10) == 10 && stackViewFromTop(&view, 10) == 89);
+
+    int value = 0;
+    for (const elem_t* element = stackViewBegin(&view); element != stackViewEnd(&view); element++)
+    {
+        assert(*element == value++);
+    }
+
+    for (StackViewReverseIterator element = stackViewRBegin(&view); element != stackViewREnd(&view); ++element)
+    {
+        assert(*element == --value);
+    }
+
+    assert(value == 0);
+
+    #if defined(STACK_NON_FATAL_ERRORS) && defined(STACK_DEBUG_MODE)
+    stackPush(&stack, 100);
+    assert(!stackViewValid(&view));
+    assert(stackViewAt(&view, 0) == elem_t());
+    assert(stackErrorStatus(&stack) == STACK_MODIFIED_WHILE_VIEWED);
+    assert(stackClearError(&stack));
+    assert(stackPop(&stack) == 100);
+    #endif
+
+    // Errors are only reported back when the check doesn't abort.
+    #if defined(STACK_NON_FATAL_ERRORS) || !defined(STACK_DEBUG_MODE)
+    assert(stackFork(&fork, &stack) == STACK_NO_ERROR);
+
+    // Both the fork and its source share frozen elements now
+    StackView frozenView = stackView(&fork);
+    assert(!stackViewValid(&frozenView));
+    assert(stackViewBegin(&frozenView) == NULL);
+    assert(stackErrorStatus(&fork) == STACK_VIEW_OF_FROZEN);
+    assert(stackClearError(&fork));
+
+    frozenView = stackView(&stack);
+    assert(!stackViewValid(&frozenView));
+    assert(stackErrorStatus(&stack) == STACK_VIEW_OF_FROZEN);
+    assert(stackClearError(&stack));
+
+    popRange(&fork, 0, 100);
+    #endif
+
+    popRange(&stack, 0, 100);
+
+    stackDestruct(&fork);
+    stackDestruct(&stack);
+}
+
+//-----------------------------------------------------------------------------
+//! Checks evaluation of operation sequences and that failed ones leave the 
+//! stack unchanged.
+//-----------------------------------------------------------------------------
+void testEvaluate()
+{
+    Stack stack = {};
+    stackConstruct(&stack, 16);
+
+    pushRange(&stack, 1, 5);
+
+    // 1, 2 - 3 * 4
+    StackOperation operations[] = {STACK_OP_MUL, STACK_OP_SUB, STACK_OP_NEG, STACK_OP_MAX};
+    assert(stackEvaluate(&stack, operations, 3) == STACK_NO_ERROR);
+    assert(stackSize(&stack) == 2);
+    assert(stackTop(&stack)  == 10);
+
+    assert(stackEvaluate(&stack, operations + 3, 1) == STACK_NO_ERROR);
+    assert(stackPop(&stack) == 10);
+
+    // Longer sequences than fit on the stack
+    StackOperation sums[39] = {};
+    for (size_t i = 0; i < 39; i++)
+    {
+        sums[i] = STACK_OP_ADD;
+    }
+
+    pushRange(&stack, 0, 40);
+    assert(stackEvaluate(&stack, sums, 39) == STACK_NO_ERROR);
+    assert(stackPop(&stack) == 39 * 40 / 2);
+    assert(stackSize(&stack) == 0);
+
+    #if defined(STACK_NON_FATAL_ERRORS) || !defined(STACK_DEBUG_MODE)
+    stackPush(&stack, -1);
+    assert(stackApplyBinary(&stack, STACK_OP_ADD) == STACK_NOT_ENOUGH_OPERANDS);
+    assert(stackClearError(&stack));
+    assert(stackTop(&stack) == -1);
+
+    // -1 - 3 is fine, sqrt(-4) isn't
+    stackPush(&stack, 3);
+    StackOperation failing[] = {STACK_OP_SUB, STACK_OP_SQRT};
+    assert(stackEvaluate(&stack, failing, 2) == STACK_DOMAIN_ERROR);
+    assert(stackErrorStatus(&stack) == STACK_DOMAIN_ERROR);
+    assert(stackClearError(&stack));
+    assert(stackOk(&stack));
+    assert(stackSize(&stack) == 2);
+
+    stackPush(&stack, 0);
+    stackPush(&stack, 0);
+    assert(stackApplyBinary(&stack, STACK_OP_DIV) == STACK_DOMAIN_ERROR);
+    assert(stackClearError(&stack));
+    popRange(&stack, 0, 1);
+    popRange(&stack, 0, 1);
+
+    assert(stackPop(&stack) == 3);
+    assert(stackPop(&stack) == -1);
+    #endif
+
+    stackDestruct(&stack);
+}
+
+//-----------------------------------------------------------------------------
+//! Checks that reductions (vectorized where the CPU allows) agree with plain 
+//! loops and that transforms refuse to produce NaN.
+//-----------------------------------------------------------------------------
+void testReduce()
+{
+    Stack stack = {};
+    stackConstruct(&stack, 16);
+
+    // Mixed magnitudes, so the order of additions shows in the last bits
+    elem_t sum = 0;
+    elem_t max = -INFINITY;
+    for (int i = 0; i < 1001; i++)
+    {
+        elem_t value = (i % 3 == 0 ? 1e6 : 1) / (i + 1);
+        stackPush(&stack, value);
+
+        sum += value;
+        max  = value > max ? value : max;
+    }
+
+    assert(fabs(stackReduce(&stack, STACK_REDUCE_SUM) - sum) <= 1e-12 * fabs(sum));
+    assert(stackReduce(&stack, STACK_REDUCE_MAX) == max);
+    assert(stackReduce(&stack, STACK_REDUCE_NAN_COUNT) == 0);
+
+    assert(stackTransform(&stack, 2, 1) == STACK_NO_ERROR);
+    assert(fabs(stackReduce(&stack, STACK_REDUCE_SUM) - (2 * sum + 1001)) <= 1e-12 * fabs(sum));
+
+    #if defined(STACK_NON_FATAL_ERRORS) || !defined(STACK_DEBUG_MODE)
+    // INFINITY * 0
+    stackPush(&stack, 0);
+    assert(stackTransform(&stack, INFINITY, 0) == STACK_DOMAIN_ERROR);
+    assert(stackClearError(&stack));
+    assert(stackPop(&stack) == 0);
+    #endif
+
+    while (stackSize(&stack) > 0)
+    {
+        stackPop(&stack);
+    }
+
+    stackDestruct(&stack);
+}
+
+#ifdef STACK_NON_FATAL_ERRORS
+//-----------------------------------------------------------------------------
+//! Checks that an error is returned, blocks the stack until it is cleared and
+//! that the stack works normally afterwards.
+//-----------------------------------------------------------------------------
+void testNonFatalErrors()
+{
+    Stack stack = {};
+    stackConstruct(&stack, 4);
+
+    pushRange(&stack, 0, 3);
+    popRange (&stack, 0, 3);
+
+    assert(stackPop(&stack) == elem_t());
+    assert(stackErrorStatus(&stack) == STACK_POP_FROM_EMPTY);
+
+    // Everything is refused until the error is cleared
+    assert(stackPush(&stack, 1) == STACK_POP_FROM_EMPTY);
+    assert(stackTop (&stack)    == elem_t());
+    assert(stackSize(&stack)    == 0);
+    assert(stackErrorStatus(&stack) == STACK_POP_FROM_EMPTY);
+
+    assert(stackClearError(&stack));
+    assert(stackOk(&stack));
+    assert(stackSize(&stack) == 0);
+
+    pushRange(&stack, 0, 10);
+    popRange (&stack, 0, 10);
+
+    // Errors that don't leave the stack intact stay
+    stack.errorStatus = STACK_MEMORY_CORRUPTION;
+    assert(!stackClearError(&stack));
+    assert(stackPush(&stack, 1) == STACK_MEMORY_CORRUPTION);
+
+    stack.errorStatus = STACK_NO_ERROR;
+    stackDestruct(&stack);
+}
+#endif
+
+#ifdef STACK_INLINE_FAST_PATH
+//-----------------------------------------------------------------------------
+//! Checks that inlined stackPush, stackPop and stackTop behave exactly like
+//! the library's fstack* functions, also when the buffer is full or a mark
+//! has to be dropped.
+//-----------------------------------------------------------------------------
+void testInlineFastPath()
+{
+    Stack inlined = {};
+    Stack library = {};
+    stackConstruct(&inlined, 4);
+    stackConstruct(&library, 4);
+
+    for (int i = 0; i < 10; i++)
+    {
+        assert(stackPush(&inlined, i) == fstackPush(&library, i));
+
+        assert(stackSize    (&inlined) == fstackSize   (&library));
+        assert(stackCapacity(&inlined) == stackCapacity(&library));
+        assert(stackTop     (&inlined) == fstackTop    (&library));
+    }
+
+    StackMark inlinedMark = stackMark(&inlined);
+    StackMark libraryMark = stackMark(&library);
+    assert(inlinedMark.depth == libraryMark.depth);
+
+    while (fstackSize(&library) > 0)
+    {
+        assert(stackPop (&inlined) == fstackPop (&library));
+        assert(stackSize(&inlined) == fstackSize(&library));
+    }
+
+    // Popping dropped the marks of both
+    assert(inlined.marksCount == 0 && library.marksCount == 0);
+
+    // Popping from an empty stack is only defined with non-fatal errors
+    #ifdef STACK_NON_FATAL_ERRORS
+    assert(stackPop(&inlined) == fstackPop(&library));
+    assert(stackErrorStatus(&inlined) == STACK_POP_FROM_EMPTY);
+    assert(stackErrorStatus(&library) == STACK_POP_FROM_EMPTY);
+    assert(stackClearError(&inlined) && stackClearError(&library));
+
+    assert(stackTop(&inlined) == fstackTop(&library));
+    assert(stackErrorStatus(&inlined) == STACK_TOP_FROM_EMPTY);
+    assert(stackErrorStatus(&library) == STACK_TOP_FROM_EMPTY);
+    assert(stackClearError(&inlined) && stackClearError(&library));
+    #endif
+
+    stackDestruct(&library);
+    stackDestruct(&inlined);
+}
+#endif
+
+#ifdef STACK_HUGE_PAGES_ENABLED
+//-----------------------------------------------------------------------------
+//! Checks that elements survive moving the buffer between mapped and heap 
+//! memory and growing it there, whatever huge pages and NUMA nodes the 
+//! system actually has.
+//-----------------------------------------------------------------------------
+void testMemoryPolicy()
+{
+    Stack stack = {};
+    Stack fork  = {};
+    stackConstruct(&stack, 16);
+    stackConstruct(&fork,  16);
+
+    pushRange(&stack, 0, 100);
+
+    StackMemoryPolicy policy = {};
+    policy.pages     = STACK_PAGES_TRANSPARENT_HUGE;
+    policy.threshold = 0;
+
+    // Mapped, then grown within the mapping and beyond it
+    assert(stackSetMemoryPolicy(&stack, &policy) == STACK_NO_ERROR);
+    pushRange(&stack, 100, 10000);
+    assert(stackOk(&stack));
+
+    // Reserved huge pages and NUMA nodes may not exist, mapping succeeds anyway
+    policy.pages     = STACK_PAGES_EXPLICIT_HUGE;
+    policy.numa      = STACK_NUMA_BIND;
+    policy.numaNodes = 1;
+    assert(stackSetMemoryPolicy(&stack, &policy) == STACK_NO_ERROR);
+
+    policy.numa      = STACK_NUMA_INTERLEAVE;
+    policy.numaNodes = 1ul << 40;
+    assert(stackSetMemoryPolicy(&stack, &policy) == STACK_NO_ERROR);
+    assert(stackOk(&stack));
+
+    // Mapped segments are shared and unmapped by the last stack to drop them
+    assert(stackFork(&fork, &stack) == STACK_NO_ERROR);
+    pushRange(&fork, 10000, 10100);
+
+    // Back to the heap once the buffer is below threshold
+    policy.threshold = 1 << 30;
+    assert(stackSetMemoryPolicy(&stack, &policy) == STACK_NO_ERROR);
+
+    popRange(&stack, 0, 10000);
+    assert(stackSize(&stack) == 0);
+    stackDestruct(&stack);
+
+    popRange(&fork, 0, 10100);
+    stackDestruct(&fork);
+}
+#endif
+
+//-----------------------------------------------------------------------------
+//! Checks that records of different lengths come back unchanged and aligned,
+//! also when a record of the stack itself is pushed again and moves the 
+//! arena, and that released space is poisoned.
+//-----------------------------------------------------------------------------
+void testRecordStack()
+{
+    RecordStack records = {};
+    recordStackConstruct(&records, 16);
+
+    const char* words[] = {"a", "stack", "of records of different lengths", ""};
+
+    for (size_t i = 0; i < 4; i++)
+    {
+        assert(recordStackPush(&records, words[i], strlen(words[i])) == STACK_NO_ERROR);
+
+        size_t      length = 0;
+        const void* top    = recordStackTop(&records, &length);
+
+        assert(length == strlen(words[i]));
+        assert(memcmp(top, words[i], length) == 0);
+        assert((uintptr_t) top % RECORD_STACK_ALIGNMENT == 0);
+    }
+
+    assert(recordStackPop(&records) == STACK_NO_ERROR);
+    assert(recordStackSize(&records) == 3);
+
+    // The top record is read from the arena while it grows
+    for (size_t i = 0; i < 20; i++)
+    {
+        size_t      length = 0;
+        const void* top    = recordStackTop(&records, &length);
+
+        assert(recordStackPush(&records, top, length) == STACK_NO_ERROR);
+    }
+
+    assert(recordStackSize(&records) == 23);
+
+    for (size_t i = 0; i < 21; i++)
+    {
+        size_t      length = 0;
+        const void* top    = recordStackTop(&records, &length);
+
+        assert(length == strlen(words[2]) && memcmp(top, words[2], length) == 0);
+        assert(recordStackPop(&records) == STACK_NO_ERROR);
+    }
+
+    assert(recordStackRelease(&records, 2) == STACK_NO_ERROR);
+    assert(recordStackSize(&records) == 0);
+
+    #ifdef STACK_POISON
+    // Released space must stay poisoned
+    uint8_t released = records.arena[0];
+    records.arena[0] = released + 1;
+
+    assert(!stackOk(&records));
+    assert(stackErrorStatus(&records) == STACK_MEMORY_CORRUPTION);
+    assert(!stackClearError(&records));
+
+    records.arena[0]    = released;
+    records.errorStatus = STACK_NO_ERROR;
+    assert(stackOk(&records));
+    #endif
+
+    #if defined(STACK_NON_FATAL_ERRORS) || !defined(STACK_DEBUG_MODE)
+    assert(recordStackRelease(&records, 1) == STACK_POP_FROM_EMPTY);
+    assert(stackClearError(&records));
+    assert(recordStackTop(&records, NULL) == NULL);
+    assert(stackErrorStatus(&records) == STACK_TOP_FROM_EMPTY);
+    assert(stackClearError(&records));
+    #endif
+
+    recordStackDestruct(&records);
+}
+
+#ifdef STACK_COMPRESSION_ENABLED
+//-----------------------------------------------------------------------------
+//! Checks that compressed elements pop back unchanged, both compressible and
+//! random ones.
+//-----------------------------------------------------------------------------
+void testCompression()
+{
+    static const size_t COUNT = 1000;
+
+    Stack stack = {};
+    stackConstruct(&stack, 16);
+    assert(stackSetCompression(&stack, 64) == STACK_NO_ERROR);
+
+    pushRange(&stack, 0, COUNT);
+    assert(stackSize(&stack) == COUNT);
+    assert(stack.frozen != NULL);
+    popRange(&stack, 0, COUNT);
+
+    elem_t   values[COUNT] = {};
+    uint64_t state         = 0x9E3779B97F4A7C15;
+
+    for (size_t i = 0; i < COUNT; i++)
+    {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+
+        // Random bits (but never NaN) leave nothing for XOR encoding
+        uint64_t bits = state & ~(1ull << 62);
+        memcpy(&values[i], &bits, sizeof(elem_t));
+
+        stackPush(&stack, values[i]);
+    }
+
+    assert(stack.frozen != NULL && stack.frozen->dynamicArray != NULL);
+
+    for (size_t i = COUNT; i > 0; i--)
+    {
+        assert(stackPop(&stack) == values[i - 1]);
+    }
+
+    stackDestruct(&stack);
+}
+#endif
+
+#ifdef STACK_SPILL_ENABLED
+//-----------------------------------------------------------------------------
+//! Checks that spilled elements pop back unchanged.
+//-----------------------------------------------------------------------------
+void testSpill()
+{
+    static const int COUNT = 10000;
+
+    Stack stack = {};
+    stackConstruct(&stack, 16);
+    assert(stackSetMemoryBudget(&stack, 256 * sizeof(elem_t)) == STACK_NO_ERROR);
+
+    pushRange(&stack, 0, COUNT);
+    assert(stackSize(&stack) == COUNT);
+    assert(stack.frozen != NULL && stack.frozen->spillFile != NULL);
+
+    popRange (&stack, COUNT / 2, COUNT);
+    pushRange(&stack, COUNT / 2, COUNT);
+    popRange (&stack, 0, COUNT);
+    assert(stackSize(&stack) == 0);
+
+    #ifdef STACK_COMPRESSION_ENABLED
+    // Compressed blocks take at most half of the budget, the rest is spilled
+    assert(stackSetCompression(&stack, 64) == STACK_NO_ERROR);
+
+    pushRange(&stack, 0, 10 * COUNT);
+    assert(stack.frozen != NULL && stack.frozen->spillFile != NULL);
+    assert(stack.frozen->coldBytes >  0);
+    assert(stack.frozen->coldBytes <= 128 * sizeof(elem_t));
+    assert(stackCapacity(&stack) * sizeof(elem_t) <= 256 * sizeof(elem_t));
+
+    popRange(&stack, 0, 10 * COUNT);
+    #endif
+
+    stackDestruct(&stack);
+}
+#endif
+
+#ifdef STACK_AGGREGATES_ENABLED
+//-----------------------------------------------------------------------------
+//! Checks that stack's min, max and sum are what they should be.
+//-----------------------------------------------------------------------------
+void checkAggregates(Stack* stack, elem_t min, elem_t max, elem_t sum)
+{
+    assert(stackMin(stack) == min);
+    assert(stackMax(stack) == max);
+    assert(stackSum(stack) == sum);
+}
+
+//-----------------------------------------------------------------------------
+//! Checks that aggregates follow evaluation and rollback.
+//-----------------------------------------------------------------------------
+void testAggregates()
+{
+    Stack stack = {};
+    stackConstruct(&stack, 16);
+    assert(stackSetAggregates(&stack, true) == STACK_NO_ERROR);
+
+    pushRange(&stack, 1, 11);
+    checkAggregates(&stack, 1, 10, 55);
+
+    // 1..7, 8 * (9 + -10)
+    StackOperation operations[] = {STACK_OP_NEG, STACK_OP_ADD, STACK_OP_MUL};
+    assert(stackEvaluate(&stack, operations, 3) == STACK_NO_ERROR);
+    checkAggregates(&stack, -8, 7, 20);
+
+    StackMark mark = stackMark(&stack);
+    stackPush(&stack, 100);
+    stackPush(&stack, -50);
+    checkAggregates(&stack, -50, 100, 70);
+
+    assert(stackRollback(&stack, mark) == STACK_NO_ERROR);
+    checkAggregates(&stack, -8, 7, 20);
+
+    assert(stackPop(&stack) == -8);
+    checkAggregates(&stack, 1, 7, 28);
+
+    stackDestruct(&stack);
+}
+#endif
+
+#ifdef STACK_REGISTRY_ENABLED
+//-----------------------------------------------------------------------------
+//! Counts stacks in *(size_t*) userData.
+//-----------------------------------------------------------------------------
+void countStack(Stack* stack, void* userData)
+{
+    assert(stack != NULL);
+    (*(size_t*) userData)++;
+}
+
+//-----------------------------------------------------------------------------
+//! Checks that the registry sees live stacks only, accounts their usage and 
+//! audits them without touching them.
+//-----------------------------------------------------------------------------
+void testRegistry()
+{
+    size_t countBefore = 0;
+    stackRegistryForEach(countStack, &countBefore);
+
+    Stack audited = {};
+    Stack other   = {};
+    stackConstruct(&audited, 16);
+    stackConstruct(&other,   16);
+
+    size_t count = 0;
+    stackRegistryForEach(countStack, &count);
+    assert(count == countBefore + 2);
+
+    pushRange(&audited, 0, 100);
+    pushRange(&other,   0, 10);
+
+    #ifdef STACK_DEBUG_MODE
+    StackMemoryUsage usage = stackRegistryUsage("audited");
+    assert(usage.stacksCount   == 1);
+    assert(usage.totalSize     == 100);
+    assert(usage.totalCapacity == audited.capacity);
+    #endif
+
+    assert(stackAuditAll(false) == 0);
+    assert(stackAuditAll(true)  == 0);
+
+    #ifdef STACK_POISON
+    assert(audited.capacity > 100);
+    audited.dynamicArray[audited.capacity - 1] = 1;
+
+    assert(stackAuditAll(true) == 1);
+    assert(audited.errorStatus == STACK_NO_ERROR);
+
+    audited.dynamicArray[audited.capacity - 1] = STACK_POISON;
+    #endif
+
+    popRange(&audited, 0, 100);
+    popRange(&other,   0, 10);
+
+    stackDestruct(&other);
+    stackDestruct(&audited);
+
+    count = 0;
+    stackRegistryForEach(countStack, &count);
+    assert(count == countBefore);
+}
+#endif
+
+#ifdef STACK_SCRUBBER_ENABLED
+//-----------------------------------------------------------------------------
+//! Remembers the stack reported by the scrubber in *(Stack**) userData.
+//-----------------------------------------------------------------------------
+void reportCorruption(Stack* stack, StackErrors error, void* userData)
+{
+    assert(error == STACK_MEMORY_CORRUPTION);
+    *(Stack**) userData = stack;
+}
+
+//-----------------------------------------------------------------------------
+//! Checks that the scrubber lets a stack be used normally and reports 
+//! corruption injected into its buffer.
+//-----------------------------------------------------------------------------
+void testScrubber()
+{
+    Stack  stack    = {};
+    Stack* reported = NULL;
+    stackConstruct(&stack, 16);
+
+    // Passes are only run below, never by the scrubber thread itself
+    assert(stackScrubberStart(1000000, reportCorruption, &reported));
+    stackScrubberRegister(&stack);
+
+    pushRange(&stack, 0, 100);
+    popRange (&stack, 50, 100);
+    assert(stackScrubberRunPass() == 0);
+    assert(stackScrubberRunPass() == 0);
+    assert(reported == NULL);
+
+    #ifdef STACK_POISON
+    stack.dynamicArray[stack.capacity - 1] = 1;
+
+    assert(stackScrubberRunPass() == 1);
+    assert(reported == &stack);
+    assert(stackErrorStatus(&stack) == STACK_MEMORY_CORRUPTION);
+
+    stack.dynamicArray[stack.capacity - 1] = STACK_POISON;
+    stack.errorStatus = STACK_NO_ERROR;
+    reported          = NULL;
+    #endif
+
+    #ifdef STACK_ARRAY_HASHING
+    // Only the hash kept by the scrubber can tell this one
+    stack.dynamicArray[0] = -1;
+
+    assert(stackScrubberRunPass() == 1);
+    assert(reported == &stack);
+    assert(stackErrorStatus(&stack) == STACK_MEMORY_CORRUPTION);
+
+    stack.dynamicArray[0] = 0;
+    stack.errorStatus     = STACK_NO_ERROR;
+    #endif
+
+    assert(stackScrubberRunPass() == 0);
+
+    stackScrubberUnregister(&stack);
+    stackScrubberStop();
+
+    assert(stackOk(&stack));
+    popRange(&stack, 0, 50);
+
+    stackDestruct(&stack);
+}
+#endif
+
 int main()
 {
+    testFork();
+    testRollback();
+    testTransfers();
+    testView();
+    testEvaluate();
+    testReduce();
+    testRecordStack();
+
+    #ifdef STACK_NON_FATAL_ERRORS
+    testNonFatalErrors();
+    #endif
+
+    #ifdef STACK_INLINE_FAST_PATH
+    testInlineFastPath();
+    #endif
+
+    #ifdef STACK_HUGE_PAGES_ENABLED
+    testMemoryPolicy();
+    #endif
+
+    #ifdef STACK_COMPRESSION_ENABLED
+    testCompression();
+    #endif
+
+    #ifdef STACK_SPILL_ENABLED
+    testSpill();
+    #endif
+
+    #ifdef STACK_AGGREGATES_ENABLED
+    testAggregates();
+    #endif
+
+    #ifdef STACK_REGISTRY_ENABLED
+    testRegistry();
+    #endif
+
+    #ifdef STACK_SCRUBBER_ENABLED
+    testScrubber();
+    #endif
+
     Stack stack = {};
     stackConstruct(&stack, 16);
 
     stackPop(&stack);
 
     stackDestruct(&stack);
-}
\ No newline at end of file
+}